@@ -0,0 +1,390 @@
+// Generator throughput benchmarks.
+//
+// Runs headlessly (no audio device) and reports, for each script given on
+// the command line, samples/sec and the real-time factor of audio_render,
+// plus the per-call cost of the chip builtins and of the bare lua_pcall
+// dispatch done by the producer. With --json, one JSON object per result is
+// appended to the given file so runs can be compared across commits.
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#include "audio.h"
+#include "sample_cache.h"
+#include "wavetable.h"
+#include "osc_block.h"
+#include "resample.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#if defined(__aarch64__)
+#define BENCH_ARCH "aarch64"
+#elif defined(__arm__)
+#define BENCH_ARCH "arm"
+#elif defined(__x86_64__) || defined(_M_X64)
+#define BENCH_ARCH "x86_64"
+#elif defined(__i386__) || defined(_M_IX86)
+#define BENCH_ARCH "x86"
+#else
+#define BENCH_ARCH "unknown"
+#endif
+
+// Seconds of audio rendered per script
+#define BENCH_SECONDS 10.0
+// Iterations for per-call measurements
+#define BENCH_CALLS 2000000L
+
+static FILE *json = NULL;
+static const char *label = "";
+
+static double now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static void report(const char *kind, const char *name, const char *metric, double value) {
+    printf("  %-10s %-28s %14.2f %s\n", kind, name, value, metric);
+    if (json) {
+        fprintf(json, "{\"label\":\"%s\",\"arch\":\"%s\",\"kind\":\"%s\",\"name\":\"%s\",\"metric\":\"%s\",\"value\":%.4f}\n",
+                label, BENCH_ARCH, kind, name, metric, value);
+    }
+}
+
+// Fresh script with the chip library
+static Script *bench_script_new(void) {
+    Script *script = script_new(audio_state.sample_rate, audio_state.buffer_size,
+                                audio_state.channels);
+    if (!script) {
+        fprintf(stderr, "Failed to initialize Lua\n");
+        exit(1);
+    }
+    return script;
+}
+
+// Render BENCH_SECONDS of audio and report throughput
+static void bench_render(Script *script, const char *kind, const char *name) {
+    int total = (int)(BENCH_SECONDS * audio_state.sample_rate);
+    float *block = (float *)malloc((size_t)audio_state.buffer_size * audio_state.channels *
+                                   sizeof(float));
+
+    double start = now();
+    for (int done = 0; done < total; done += audio_state.buffer_size) {
+        script_render(script, block, audio_state.buffer_size, audio_state.volume);
+    }
+    double elapsed = now() - start;
+    free(block);
+
+    double rate = total / elapsed;
+    report(kind, name, "samples/s", rate);
+    report(kind, name, "x realtime", rate / audio_state.sample_rate);
+    report(kind, name, "ns/sample", elapsed * 1e9 / total);
+}
+
+static void bench_script(const char *path) {
+    Script *script = script_open(path, audio_state.sample_rate, audio_state.buffer_size,
+                                 audio_state.channels, 0.0, 0);
+    if (script) {
+        bench_render(script, "script", path);
+        script_free(script);
+    }
+}
+
+// Script whose generator is returned by code
+static Script *bench_inline(const char *code) {
+    Script *script = bench_script_new();
+    if (luaL_dostring(script->L, code) != 0 || script_install(script) != 0) {
+        fprintf(stderr, "%s\n", lua_tostring(script->L, -1));
+        exit(1);
+    }
+    return script;
+}
+
+// Cost of what the producer does around the script: one lua_pcall per
+// sample for main(t), one per block for main(t0, dt, n, out), none for a
+// bytebeat expression
+static void bench_dispatch(void) {
+    Script *script = bench_inline("return function(t) return 0 end");
+    bench_render(script, "dispatch", "per-sample pcall");
+    script_free(script);
+
+    script = bench_inline("return { block = function(t0, dt, n, out) end }");
+    bench_render(script, "dispatch", "block pcall");
+    script_free(script);
+
+    // A control function only costs a Lua call every 64 samples
+    script = bench_inline("local lfo = chip.kr(function(t) return math.sin(t) end, 64)\n"
+                          "return function(t) return lfo:value() end");
+    bench_render(script, "dispatch", "per-sample kr:value()");
+    script_free(script);
+
+    // Blocks are split at every event, so this adds 8 spans a second
+    script = bench_inline("chip.every(0.125, function(t) end)\n"
+                          "return { block = function(t0, dt, n, out) end }");
+    bench_render(script, "dispatch", "block pcall + every(0.125)");
+    script_free(script);
+
+    script = bench_inline("return chip.expr('t*(t>>5|t>>8)')");
+    bench_render(script, "dispatch", "bytebeat expr");
+    script_free(script);
+}
+
+// Real-time factor of BENCH_SECONDS of output at the device rate through a
+// resampler from 'rate', with the input rendered by script (or silence)
+static double time_resampled(Script *script, int rate) {
+    const int block = audio_state.buffer_size;
+    const int ch = audio_state.channels;
+    const int total = (int)(BENCH_SECONDS * audio_state.sample_rate);
+    float *out = (float *)malloc((size_t)block * ch * sizeof(float));
+    Resampler rs;
+    if (!out || resampler_init(&rs, rate, audio_state.sample_rate, ch, block) != 0) {
+        fprintf(stderr, "Failed to allocate the resampler\n");
+        exit(1);
+    }
+
+    double start = now();
+    for (int done = 0; done < total; done += block) {
+        int want = resampler_want(&rs, block);
+        float *in = resampler_write_span(&rs, want);
+        for (int i = 0; i < want; i += block) {
+            int n = want - i < block ? want - i : block;
+            if (script) {
+                script_render(script, in + (size_t)i * ch, n, audio_state.volume);
+            } else {
+                memset(in + (size_t)i * ch, 0, (size_t)n * ch * sizeof(float));
+            }
+        }
+        resampler_read(&rs, out, block);
+    }
+    double elapsed = now() - start;
+    resampler_free(&rs);
+    free(out);
+    return total / elapsed / audio_state.sample_rate;
+}
+
+// Cost of --render-rate: the resampler on its own, and a per-sample script
+// run at a lower rate and resampled, against the same script at full rate
+static void bench_resample(void) {
+    static const int rates[] = {8000, 11025, 22050};
+    static const char *code = "return function(t) return chip.sin(t, 440) end";
+    const int block = audio_state.buffer_size;
+    const int total = (int)(BENCH_SECONDS * audio_state.sample_rate);
+    char name[64];
+
+    Script *script = bench_inline(code);
+    float *out = (float *)malloc((size_t)block * audio_state.channels * sizeof(float));
+    double start = now();
+    for (int done = 0; done < total; done += block) {
+        script_render(script, out, block, audio_state.volume);
+    }
+    double elapsed = now() - start;
+    free(out);
+    script_free(script);
+    snprintf(name, sizeof(name), "sin script at %d", audio_state.sample_rate);
+    report("resample", name, "x realtime", total / elapsed / audio_state.sample_rate);
+
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        snprintf(name, sizeof(name), "%d -> %d", rates[i], audio_state.sample_rate);
+        report("resample", name, "x realtime", time_resampled(NULL, rates[i]));
+
+        script = script_new(rates[i], block, audio_state.channels);
+        if (!script || luaL_dostring(script->L, code) != 0 || script_install(script) != 0) {
+            fprintf(stderr, "Failed to set up the resampled script\n");
+            exit(1);
+        }
+        snprintf(name, sizeof(name), "sin script at %d", rates[i]);
+        report("resample", name, "x realtime", time_resampled(script, rates[i]));
+        script_free(script);
+    }
+}
+
+// Time a Lua loop calling chip[name] BENCH_CALLS times
+static double time_loop(lua_State *L, const char *code, const char *name) {
+    if (luaL_loadstring(L, code) != 0) {
+        fprintf(stderr, "%s\n", lua_tostring(L, -1));
+        exit(1);
+    }
+    lua_getglobal(L, "chip");
+    lua_getfield(L, -1, name);
+    lua_remove(L, -2);
+    lua_pushinteger(L, BENCH_CALLS);
+
+    double start = now();
+    if (lua_pcall(L, 2, 0, 0) != 0) {
+        fprintf(stderr, "%s: %s\n", name, lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return 0.0;
+    }
+    return now() - start;
+}
+
+static void bench_builtins(void) {
+    static const char *osc_loop =
+        "local f, n = ...\n"
+        "local dt = 1 / 44100\n"
+        "for i = 1, n do f(i * dt, 440) end\n";
+    static const char *rnd_loop =
+        "local f, n = ...\n"
+        "for i = 1, n do f() end\n";
+    static const char *empty_loop =
+        "local f, n = ...\n"
+        "local dt = 1 / 44100\n"
+        "for i = 1, n do local t = i * dt end\n";
+    static const char *oscs[] = {"sin", "saw", "sq", "tri", NULL};
+
+    Script *script = bench_script_new();
+    lua_State *L = script->L;
+    double base = time_loop(L, empty_loop, "sin");
+
+    for (int i = 0; oscs[i]; i++) {
+        double t = time_loop(L, osc_loop, oscs[i]);
+        report("builtin", oscs[i], "ns/call", (t - base) * 1e9 / BENCH_CALLS);
+    }
+    // Band-limited wavetables against the naive oscillators above
+    static const char *wt_loop =
+        "local f, n = ...\n"
+        "local dt = 1 / 44100\n"
+        "for i = 1, n do f('saw', i * dt, 440) end\n";
+    double t = time_loop(L, wt_loop, "wt");
+    report("builtin", "wt saw", "ns/call", (t - base) * 1e9 / BENCH_CALLS);
+    t = time_loop(L, rnd_loop, "rnd");
+    report("builtin", "rnd", "ns/call", t * 1e9 / BENCH_CALLS);
+
+    static const char *block_loop =
+        "local f, n = ...\n"
+        "local buf, dt = {}, 1 / 44100\n"
+        "for i = 1, 512 do buf[i] = 0 end\n"
+        "for i = 1, n / 512 do f(buf, i * 512 * dt, dt, 440) end\n";
+    static const char *block_oscs[] = {"sinb", "sawb", "sqb", "trib", NULL};
+    for (int i = 0; block_oscs[i]; i++) {
+        t = time_loop(L, block_loop, block_oscs[i]);
+        report("builtin", block_oscs[i], "ns/sample", t * 1e9 / BENCH_CALLS);
+    }
+
+    static const char *wtb_loop =
+        "local f, n = ...\n"
+        "local buf, dt = {}, 1 / 44100\n"
+        "for i = 1, 512 do buf[i] = 0 end\n"
+        "for i = 1, n / 512 do f(buf, 'saw', i * 512 * dt, dt, 440) end\n";
+    t = time_loop(L, wtb_loop, "wtb");
+    report("builtin", "wtb saw", "ns/sample", t * 1e9 / BENCH_CALLS);
+
+    static const char *noise_loop =
+        "local f, n = ...\n"
+        "local buf = {}\n"
+        "for i = 1, 512 do buf[i] = 0 end\n"
+        "for i = 1, n / 512 do f(buf) end\n";
+    static const char *noises[] = {"whiteb", "pinkb", "brownb", NULL};
+    for (int i = 0; noises[i]; i++) {
+        t = time_loop(L, noise_loop, noises[i]);
+        report("builtin", noises[i], "ns/sample", t * 1e9 / BENCH_CALLS);
+    }
+
+    // DSP units: processBlock over a 512-sample table
+    static const struct {
+        const char *name;
+        const char *args;
+    } units[] = {
+        {"biquad", "'lp', 1000, 0.7"},
+        {"delay", "0.25, 0.1, 0.5"},
+        {"comb", "0.03, 0.8"},
+        {"allpass", "0.005, 0.7"},
+        {"onepole", "50"},
+        {"adsr", "0.01, 0.1, 0.5, 0.2"},
+    };
+    for (int i = 0; i < (int)(sizeof(units) / sizeof(units[0])); i++) {
+        char code[256];
+        snprintf(code, sizeof(code),
+                 "local make, n = ...\n"
+                 "local unit, buf = make(%s), {}\n"
+                 "for i = 1, 512 do buf[i] = 0 end\n"
+                 "for i = 1, n / 512 do unit:processBlock(buf) end\n",
+                 units[i].args);
+        t = time_loop(L, code, units[i].name);
+        report("builtin", units[i].name, "ns/sample", t * 1e9 / BENCH_CALLS);
+    }
+    script_free(script);
+}
+
+// Block oscillator kernels called directly from C
+static void bench_kernels(void) {
+    static const struct {
+        const char *name;
+        void (*fn)(float *, int, double, double);
+    } kernels[] = {
+        {"osc_block_sin", osc_block_sin},
+        {"osc_block_saw", osc_block_saw},
+        {"osc_block_sq", osc_block_sq},
+        {"osc_block_tri", osc_block_tri},
+    };
+    float buf[512];
+
+    printf("  kernels: %s\n", osc_block_simd());
+    for (int k = 0; k < (int)(sizeof(kernels) / sizeof(kernels[0])); k++) {
+        double start = now();
+        for (long i = 0; i < BENCH_CALLS; i += 512) {
+            kernels[k].fn(buf, 512, i * 0.01, 0.01);
+        }
+        report("kernel", kernels[k].name, "ns/sample", (now() - start) * 1e9 / BENCH_CALLS);
+    }
+
+    int saw = wavetable_find("saw");
+    double start = now();
+    for (long i = 0; i < BENCH_CALLS; i += 512) {
+        wavetable_fill(saw, buf, 512, i * 0.01, 0.01);
+    }
+    report("kernel", "wavetable_fill", "ns/sample", (now() - start) * 1e9 / BENCH_CALLS);
+}
+
+int main(int argc, char *argv[]) {
+    int first = 1;
+    while (first < argc && argv[first][0] == '-') {
+        if (strcmp(argv[first], "--json") == 0 && first + 1 < argc) {
+            json = fopen(argv[first + 1], "a");
+            if (!json) {
+                fprintf(stderr, "Cannot open %s\n", argv[first + 1]);
+                return 1;
+            }
+        } else if (strcmp(argv[first], "--label") == 0 && first + 1 < argc) {
+            label = argv[first + 1];
+        } else {
+            fprintf(stderr, "Usage: %s [--json results.jsonl] [--label name] [script.lua...]\n", argv[0]);
+            return 1;
+        }
+        first += 2;
+    }
+
+    audio_configure(0, 0, 0);
+    sample_cache_init(64 * 1024 * 1024, 0);
+    wavetable_init();
+
+    printf("Benchmarks (%s)\n", BENCH_ARCH);
+    bench_dispatch();
+    bench_builtins();
+    bench_kernels();
+    bench_resample();
+    for (int i = first; i < argc; i++) {
+        bench_script(argv[i]);
+    }
+
+    sample_cache_shutdown();
+    wavetable_shutdown();
+    if (json) {
+        fclose(json);
+    }
+    return 0;
+}
@@ -0,0 +1,10 @@
+-- Block example: one call renders a whole buffer
+local function main(t0, dt, n, out)
+    for i = 1, n do
+        local t = t0 + (i - 1) * dt
+        out[i] = 0.5 * math.sin(2 * math.pi * 220 * t)
+    end
+end
+
+-- Returning a table with a 'block' function opts into the block contract
+return { block = main }
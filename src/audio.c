@@ -2,11 +2,11 @@
 #include <stdlib.h>
 #include <math.h>
 #include <portaudio.h>
-#include <sndfile.h>
-#include <time.h>
 #include <string.h>
 #include "audio.h"
-#include <sys/stat.h>
+#include "stats.h"
+#include "rt.h"
+#include "record.h"
 
 // Windows-specific includes
 #ifdef _WIN32
@@ -16,13 +16,34 @@
 // Audio settings
 #define SAMPLE_RATE 44100
 #define FRAMES_PER_BUFFER 512
-#define PI 3.14159265358979323846
+#define CHANNELS 1
+#define RING_BLOCKS 8
+// Adaptive latency: the ring is allocated for the largest depth up front,
+// grows by ADAPT_GROW_BLOCKS on an underrun and shrinks one block at a
+// time after ADAPT_WINDOW_S seconds without underruns in which the queue
+// never ran lower than one block
+#define ADAPT_MAX_BLOCKS 32
+#define ADAPT_MIN_BLOCKS 2
+#define ADAPT_GROW_BLOCKS 2
+#define ADAPT_WINDOW_S 5.0
+#define CROSSFADE_MS 10
+// Mix without waiting for late tracks once the device has less than this
+// many blocks queued
+#define MIX_DEADLINE_BLOCKS 2
+// Time between slow track reports and stats lines
+#define REPORT_MS 1000
 
 // Audio state
 AudioState audio_state = {0};
 static PaStream *stream = NULL;
 static int audio_initialized = 0;
 
+// The callback wakes the producer once the queue drops to half the target
+// latency, so it refills in batches instead of polling; the main loop
+// sleeps until a report is due or audio_interrupt is called
+static Wakeup producer_wake;
+static Semaphore main_wake;
+
 // Threading
 #ifdef _WIN32
 static HANDLE producer_thread = NULL;
@@ -40,25 +61,24 @@ static int audio_callback(const void *input, void *output,
                          PaStreamCallbackFlags status_flags,
                          void *user_data);
 
+// Set up render settings shared by live and offline modes
+void audio_configure(int sample_rate, int buffer_size, int ring_blocks) {
+    audio_state.sample_rate = sample_rate > 0 ? sample_rate : SAMPLE_RATE;
+    audio_state.buffer_size = buffer_size > 0 ? buffer_size : FRAMES_PER_BUFFER;
+    audio_state.ring_blocks = ring_blocks > 0 ? ring_blocks : RING_BLOCKS;
+    audio_state.channels = CHANNELS;
+    audio_state.volume = 0.5f; // Default volume
+    audio_state.crossfade = audio_state.sample_rate * CROSSFADE_MS / 1000;
+}
+
 // Initialize audio system
 int audio_init(void) {
-    if (!audio_state.L) {
-        fprintf(stderr, "Error: Lua state not initialized\n");
-        return 1;
-    }
-
-    printf("Audio state: L=%p, sample_rate=%d, time=%.2f\n", 
-       audio_state.L, audio_state.sample_rate, audio_state.time);
-
     PaError err;
     
     if (audio_initialized) {
         return 0; // Already initialized
     }
     
-    // Initialize random number generator
-    srand((unsigned int)time(NULL));
-    
     // Initialize PortAudio
     err = Pa_Initialize();
     if (err != paNoError) {
@@ -66,19 +86,27 @@ int audio_init(void) {
         return 1;
     }
     
-    // Set up audio state
-    audio_state.sample_rate = SAMPLE_RATE;
-    audio_state.buffer_size = FRAMES_PER_BUFFER;
-    audio_state.time = 0.0;
-    audio_state.volume = 0.5f; // Default volume
-    // Allocate ring buffer (8 buffers worth)
-    if (!audio_state.rb_data) {
-        audio_state.rb_size = (unsigned int)(audio_state.buffer_size * 8);
-        audio_state.rb_data = (float *)calloc(audio_state.rb_size, sizeof(float));
-        audio_state.rb_read = 0;
-        audio_state.rb_write = 0;
-        audio_state.rb_count = 0;
-        audio_state.producer_running = 0;
+    if (wakeup_init(&producer_wake) != 0 || semaphore_init(&main_wake) != 0) {
+        fprintf(stderr, "Error: Failed to create semaphores\n");
+        Pa_Terminate();
+        return 1;
+    }
+
+    // Allocate ring buffer, with room to grow in adaptive mode so the
+    // latency can change without reallocating
+    if (!audio_state.rb.data) {
+        int blocks = audio_state.ring_blocks;
+        if (audio_state.adaptive && blocks < ADAPT_MAX_BLOCKS) {
+            blocks = ADAPT_MAX_BLOCKS;
+        }
+        atomic_store(&audio_state.latency, (unsigned int)(audio_state.buffer_size * audio_state.ring_blocks));
+        if (rb_init(&audio_state.rb, (unsigned int)(audio_state.buffer_size * blocks),
+                    (unsigned int)audio_state.channels) != 0) {
+            fprintf(stderr, "Error: Failed to allocate ring buffer\n");
+            Pa_Terminate();
+            return 1;
+        }
+        atomic_store(&audio_state.producer_running, 0);
     }
     
     // List available devices
@@ -105,16 +133,16 @@ int audio_init(void) {
             deviceInfo->maxInputChannels, 
             deviceInfo->maxOutputChannels);
         
-        if (deviceInfo->maxOutputChannels > 0) {
+        if (deviceInfo->maxOutputChannels >= audio_state.channels) {
             PaStreamParameters outputParameters = {0};
             outputParameters.device = i;
-            outputParameters.channelCount = 1;
+            outputParameters.channelCount = audio_state.channels;
             outputParameters.sampleFormat = paFloat32;
             outputParameters.suggestedLatency = deviceInfo->defaultLowOutputLatency;
             outputParameters.hostApiSpecificStreamInfo = NULL;
             
-            printf("  Trying to open with %dHz, %d frames/buffer...\n", 
-                audio_state.sample_rate, audio_state.buffer_size);
+            printf("  Trying to open with %dHz, %d frames/buffer, %d channels...\n", 
+                audio_state.sample_rate, audio_state.buffer_size, audio_state.channels);
             
             PaError err = Pa_OpenStream(
                 &stream,
@@ -173,9 +201,40 @@ int audio_process(void) {
         return 1;
     }
     
-    // Small sleep to prevent busy-waiting
-    Pa_Sleep(10);
-    
+    // Sleep until the next report is due, or until interrupted
+    static double next_report = 0.0;
+    double now = stats_now();
+    if (next_report == 0.0) {
+        next_report = now + REPORT_MS / 1000.0;
+    }
+    if (now < next_report) {
+        semaphore_timedwait(&main_wake, (int)((next_report - now) * 1000.0) + 1);
+    }
+
+    // Report tracks the mixer had to play as silence and recording that
+    // fell behind, and log stats
+    static unsigned int reported[TRACK_MAX];
+    static unsigned long long record_reported;
+    if (stats_now() >= next_report) {
+        next_report += REPORT_MS / 1000.0;
+        for (int i = 0; i < audio_state.track_count; i++) {
+            Track *track = &audio_state.tracks[i];
+            unsigned int missed = atomic_load(&track->underruns) - reported[i];
+            if (missed > 0) {
+                fprintf(stderr, "Warning: %s is too slow, %u blocks were skipped\n",
+                        track->path, missed);
+                reported[i] += missed;
+            }
+        }
+        unsigned long long dropped = record_dropped();
+        if (dropped > record_reported) {
+            fprintf(stderr, "Warning: the disk is too slow for the recording, %llu frames were dropped\n",
+                    dropped - record_reported);
+            record_reported = dropped;
+        }
+        stats_log();
+    }
+
     return 0;
 }
 
@@ -212,12 +271,11 @@ void audio_cleanup(void) {
     }
     
     audio_initialized = 0;
+    wakeup_destroy(&producer_wake);
+    semaphore_destroy(&main_wake);
     // Free ring buffer
-    if (audio_state.rb_data) {
-        free(audio_state.rb_data);
-        audio_state.rb_data = NULL;
-        audio_state.rb_size = 0;
-        audio_state.rb_read = audio_state.rb_write = audio_state.rb_count = 0;
+    if (audio_state.rb.data) {
+        rb_free(&audio_state.rb);
     }
 }
 
@@ -230,34 +288,77 @@ static int audio_callback(const void *input, void *output,
     AudioState *state = (AudioState *)user_data;
     float *out = (float *)output;
     (void)input;
-    (void)time_info;
     (void)status_flags;
     
-    // Initialize output to silence
-    memset(out, 0, frame_count * sizeof(float));
-    
     // Safety checks (no Lua access here)
     if (!state) {
+        memset(out, 0, frame_count * audio_state.channels * sizeof(float));
         return paContinue;
     }
 
-    // Pull from ring buffer
-    unsigned long needed = frame_count;
-    unsigned long i = 0;
-    while (i < needed) {
-        if (state->rb_count == 0) {
-            // Underrun: leave remaining zeros
-            break;
-        }
-        float s = state->rb_data[state->rb_read];
-        out[i++] = s;
-        state->rb_read = (state->rb_read + 1) % state->rb_size;
-        state->rb_count--;
+    // Pull interleaved frames from the ring buffer in at most two spans
+    const unsigned int ch = (unsigned int)state->channels;
+    unsigned int fill = rb_count(&state->rb);
+    unsigned int got = rb_read(&state->rb, out, (unsigned int)frame_count);
+    if (got < frame_count) {
+        // Underrun: pad with silence
+        memset(out + got * ch, 0, (frame_count - got) * ch * sizeof(float));
+    }
+    stats_callback(time_info ? time_info->currentTime : 0.0, (unsigned int)frame_count,
+                   fill, got, state->sample_rate);
+
+    // Past the low-water mark: have the producer top the queue back up
+    if (fill - got <= atomic_load(&state->latency) / 2) {
+        wakeup_signal(&producer_wake);
     }
     return paContinue;
 }
 
-// Producer thread: fills ring buffer by calling Lua main(t)
+// Adaptive latency, run by the producer between blocks. Raising the
+// target only makes the producer queue more; lowering it lets the device
+// drain the excess, so neither causes a glitch.
+typedef struct Adapt {
+    unsigned long long underruns;
+    unsigned int low;         // lowest queue seen in this window
+    double since;             // start of the window
+} Adapt;
+
+static void adapt_latency(AudioState *state, Adapt *adapt) {
+    const unsigned int block = (unsigned int)state->buffer_size;
+    unsigned int latency = atomic_load(&state->latency);
+    unsigned int fill = rb_count(&state->rb);
+    unsigned long long underruns = stats_underruns();
+    double now = stats_now();
+
+    if (fill < adapt->low) {
+        adapt->low = fill;
+    }
+    if (underruns != adapt->underruns) {
+        unsigned int max = state->rb.size - state->rb.size % block;
+        adapt->underruns = underruns;
+        if (latency < max) {
+            latency += block * ADAPT_GROW_BLOCKS;
+            if (latency > max) latency = max;
+            atomic_store(&state->latency, latency);
+        }
+    } else if (now - adapt->since >= ADAPT_WINDOW_S) {
+        if (adapt->low >= block && latency > block * ADAPT_MIN_BLOCKS) {
+            latency -= block;
+            atomic_store(&state->latency, latency);
+        }
+    } else {
+        return;
+    }
+    adapt->low = fill;
+    adapt->since = now;
+}
+
+// CPU for the producer (thread 0) or track thread - 1, or -1 to not pin
+static int audio_cpu(const AudioState *state, int thread) {
+    return state->cpu_count > 0 ? state->cpus[thread % state->cpu_count] : -1;
+}
+
+// Producer thread: mixes the tracks' blocks into the ring buffer
 #ifdef _WIN32
 static DWORD WINAPI producer_func(LPVOID arg)
 #else
@@ -265,70 +366,64 @@ static void *producer_func(void *arg)
 #endif
 {
     AudioState *state = (AudioState *)arg;
-    lua_State *L = state->L;
-    const double dt = 1.0 / (double)state->sample_rate;
-    struct stat st;
-
-    while (state->producer_running) {
-        // Check for script changes and hot-reload
-        if (state->script_path[0] != '\0') {
-            if (stat(state->script_path, &st) == 0) {
-                long mtime = (long)st.st_mtime;
-                if (state->script_mtime != 0 && mtime != state->script_mtime) {
-                    // Reload script
-                    if (luaL_dofile(L, state->script_path) == 0 && lua_isfunction(L, -1)) {
-                        lua_setglobal(L, "main");
-                        // Reset ring buffer to avoid mixing old/new
-                        state->rb_read = state->rb_write = state->rb_count = 0;
-                        state->script_mtime = mtime;
-                    } else {
-                        // On error, pop error and continue with previous main
-                        if (!lua_isfunction(L, -1)) {
-                            lua_pop(L, 1);
-                        }
-                    }
-                } else if (state->script_mtime == 0) {
-                    state->script_mtime = mtime;
-                }
-            }
+    const unsigned int block = (unsigned int)state->buffer_size;
+    float *scratch = (float *)malloc(block * state->channels * sizeof(float));
+
+    if (state->realtime > 0 || state->cpu_count > 0) {
+        rt_thread(state->realtime, audio_cpu(state, 0), "the producer");
+    }
+
+    // Let every track render its first block before mixing
+    while (state->producer_running && !track_ready(state->tracks, state->track_count, block)) {
+        Pa_Sleep(1);
+    }
+    Adapt adapt = {stats_underruns(), state->rb.size, stats_now()};
+
+    while (state->producer_running && scratch) {
+        if (state->adaptive) {
+            adapt_latency(state, &adapt);
         }
-        // Fill up to one buffer worth when space available
-        while (state->producer_running && state->rb_count <= state->rb_size - (unsigned int)state->buffer_size) {
-            // Call Lua per-sample for one buffer
-            for (int n = 0; n < state->buffer_size; n++) {
-                // Push function
-                lua_getglobal(L, "main");
-                if (!lua_isfunction(L, -1)) {
-                    lua_pop(L, 1);
-                    // push silence
-                    state->rb_data[state->rb_write] = 0.0f;
-                } else {
-                    lua_pushnumber(L, state->time);
-                    if (lua_pcall(L, 1, 1, 0) != 0) {
-                        // error -> silence
-                        lua_pop(L, 1);
-                        state->rb_data[state->rb_write] = 0.0f;
-                    } else {
-                        float sample = 0.0f;
-                        if (lua_isnumber(L, -1)) {
-                            double v = lua_tonumber(L, -1);
-                            if (v > 1.0) v = 1.0;
-                            if (v < -1.0) v = -1.0;
-                            sample = (float)(v * state->volume);
-                        }
-                        lua_pop(L, 1);
-                        state->rb_data[state->rb_write] = sample;
-                    }
-                }
-                state->rb_write = (state->rb_write + 1) % state->rb_size;
-                state->rb_count++;
-                state->time += dt;
+        unsigned int latency = atomic_load(&state->latency);
+        unsigned int deadline = block * MIX_DEADLINE_BLOCKS;
+        if (deadline > latency / 2) deadline = latency / 2;
+        int stalled = 0;
+
+        // Mix one buffer at a time until the target latency is queued,
+        // straight into the ring's writable span(s). Tracks that are late
+        // get until the device is about to run dry, then they are mixed
+        // as silence.
+        while (state->producer_running && rb_count(&state->rb) + block <= latency) {
+            if (!track_ready(state->tracks, state->track_count, block) &&
+                rb_count(&state->rb) >= deadline) {
+                // Check again after the next callback
+                stalled = 1;
+                break;
+            }
+
+            unsigned int todo = block;
+            while (todo > 0) {
+                unsigned int len;
+                float *span = rb_write_span(&state->rb, &len);
+                if (len > todo) len = todo;
+                track_mix(state->tracks, state->track_count, span, scratch, len, state->volume, 0);
+                record_write(span, len);
+                rb_commit_write(&state->rb, len);
+                todo -= len;
             }
         }
-        // Sleep briefly to yield
-        Pa_Sleep(1);
+        // Sleep until the callback passes the low-water mark. Arming first
+        // means a callback that drains the queue after the check still
+        // wakes us.
+        wakeup_arm(&producer_wake);
+        if (state->producer_running &&
+            (stalled || rb_count(&state->rb) > atomic_load(&state->latency) / 2)) {
+            wakeup_wait(&producer_wake);
+            stats_wakeup();
+        }
     }
 
+    free(scratch);
+
 #ifdef _WIN32
     return 0;
 #else
@@ -336,18 +431,41 @@ static void *producer_func(void *arg)
 #endif
 }
 
+void audio_interrupt(void) {
+    if (audio_initialized) {
+        semaphore_post(&main_wake);
+    }
+}
+
+static void stop_tracks(void) {
+    for (int i = 0; i < audio_state.track_count; i++) {
+        track_stop(&audio_state.tracks[i]);
+    }
+}
+
 int audio_start_producer(void) {
     if (!audio_initialized || audio_state.producer_running) return 0;
+    for (int i = 0; i < audio_state.track_count; i++) {
+        Track *track = &audio_state.tracks[i];
+        track->priority = audio_state.realtime > 1 ? audio_state.realtime - 1 : audio_state.realtime;
+        track->cpu = audio_cpu(&audio_state, i + 1);
+        if (track_start(&audio_state.tracks[i]) != 0) {
+            stop_tracks();
+            return 1;
+        }
+    }
     audio_state.producer_running = 1;
 #ifdef _WIN32
     producer_thread = CreateThread(NULL, 0, producer_func, &audio_state, 0, NULL);
     if (producer_thread == NULL) {
         audio_state.producer_running = 0;
+        stop_tracks();
         return 1;
     }
 #else
     if (pthread_create(&producer_thread, NULL, producer_func, &audio_state) != 0) {
         audio_state.producer_running = 0;
+        stop_tracks();
         return 1;
     }
 #endif
@@ -357,6 +475,7 @@ int audio_start_producer(void) {
 void audio_stop_producer(void) {
     if (!audio_state.producer_running) return;
     audio_state.producer_running = 0;
+    wakeup_signal(&producer_wake);
 #ifdef _WIN32
     if (producer_thread) {
         WaitForSingleObject(producer_thread, INFINITE);
@@ -366,4 +485,5 @@ void audio_stop_producer(void) {
 #else
     pthread_join(producer_thread, NULL);
 #endif
+    stop_tracks();
 }
@@ -2,40 +2,57 @@
 #define AUDIO_H
 
 #include <lua.h>
+#include <stdatomic.h>
+#include "ringbuf.h"
+#include "script.h"
+#include "track.h"
 
 typedef struct AudioState {
-    lua_State *L;
-    double time;
+    Track tracks[TRACK_MAX];  // one per script, mixed by the producer
+    int track_count;
     int sample_rate;
     int buffer_size;
+    int channels;             // interleaved output channels
     float volume;
-    // Ring buffer for pre-rendered audio (mono)
-    float *rb_data;
-    unsigned int rb_size;     // total samples capacity
-    volatile unsigned int rb_read;  // read index
-    volatile unsigned int rb_write; // write index
-    volatile unsigned int rb_count; // number of samples available
-    volatile int producer_running;
-    // Live reload support
-    char script_path[256];
-    long script_mtime;
+    int crossfade;            // samples to crossfade over on reload
+    // Ring buffer for pre-rendered audio (interleaved frames), producer -> callback
+    RingBuffer rb;
+    int ring_blocks;          // blocks kept queued for the device
+    int adaptive;             // 1 to tune the queued blocks from underruns
+    int realtime;             // SCHED_FIFO priority of the producer (0 = normal)
+    int cpus[TRACK_MAX + 1];  // CPUs to pin the producer and then each track to
+    int cpu_count;            // 0 = no pinning
+    atomic_uint latency;      // frames the producer keeps queued
+    atomic_int producer_running;
 } AudioState;
 
 extern AudioState audio_state;
 
-// Initialize audio system
+// Set sample rate, block size, ring depth (in blocks), channels, volume
+// and crossfade; 0 picks the default for the first three
+void audio_configure(int sample_rate, int buffer_size, int ring_blocks);
+
+// Initialize audio system (after audio_configure)
 int audio_init(void);
 
-// Process audio (called in the main loop)
+// Process audio and report tracks that fall behind (called in the main
+// loop). Sleeps until the next report is due, about once a second.
 int audio_process(void);
 
+// Wake audio_process early, e.g. from a signal handler
+void audio_interrupt(void);
+
 // Clean up audio resources
 void audio_cleanup(void);
 
-// Lua API functions
-int luaopen_audio(lua_State *L);
+// Lua API functions: fill the chip table of a script's lua_State
+int luaopen_audio(lua_State *L, Script *script);
 
-// Producer control
+// Producer control: the producer starts every track's render thread and
+// mixes their output into the ring. With 'realtime' set, the producer runs
+// at that SCHED_FIFO priority and the tracks just below it; with cpus
+// given, the producer is pinned to the first and the tracks to the next
+// ones in turn.
 int audio_start_producer(void);
 void audio_stop_producer(void);
 
@@ -44,9 +61,39 @@ int l_sin(lua_State *L);
 int l_saw(lua_State *L);
 int l_sq(lua_State *L);
 int l_tri(lua_State *L);
+int l_sinb(lua_State *L);
+int l_sawb(lua_State *L);
+int l_sqb(lua_State *L);
+int l_trib(lua_State *L);
+int l_osc(lua_State *L);
+int l_biquad(lua_State *L);
+int l_delay(lua_State *L);
+int l_comb(lua_State *L);
+int l_allpass(lua_State *L);
+int l_onepole(lua_State *L);
+int l_adsr(lua_State *L);
+int l_kr(lua_State *L);
+int l_expr(lua_State *L);
+int l_at(lua_State *L);
+int l_every(lua_State *L);
+int l_pattern(lua_State *L);
+int l_cancel(lua_State *L);
+int l_record(lua_State *L);
+int l_stoprecord(lua_State *L);
 int l_spl(lua_State *L);
+int l_preload(lua_State *L);
+int l_wt(lua_State *L);
+int l_wtb(lua_State *L);
+int l_wtload(lua_State *L);
+int l_gain(lua_State *L);
+int l_pure(lua_State *L);
+int l_stats(lua_State *L);
 int l_rnd(lua_State *L);
 int l_rndf(lua_State *L);
 int l_rndi(lua_State *L);
+int l_seed(lua_State *L);
+int l_whiteb(lua_State *L);
+int l_pinkb(lua_State *L);
+int l_brownb(lua_State *L);
 
 #endif // AUDIO_H
@@ -0,0 +1,272 @@
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <string.h>
+#include "dsp.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Filter state below this is flushed to zero, so a filter ringing out
+// into silence never falls into slow denormal arithmetic
+#define DSP_TINY 1e-20
+
+static double flush(double v) {
+    return fabs(v) < DSP_TINY ? 0.0 : v;
+}
+
+// Biquad
+
+void biquad_init(Biquad *bq, int kind, double freq, double q, double sample_rate) {
+    memset(bq, 0, sizeof(*bq));
+    bq->kind = kind;
+    biquad_set(bq, freq, q, sample_rate);
+}
+
+void biquad_set(Biquad *bq, double freq, double q, double sample_rate) {
+    // Keep the cutoff inside (0, Nyquist) and Q positive
+    double nyquist = sample_rate * 0.49;
+    if (freq < 1.0) freq = 1.0;
+    if (freq > nyquist) freq = nyquist;
+    if (q < 0.01) q = 0.01;
+
+    double w0 = 2.0 * M_PI * freq / sample_rate;
+    double cw = cos(w0);
+    double alpha = sin(w0) / (2.0 * q);
+    double b0, b1, b2;
+    switch (bq->kind) {
+    case BIQUAD_HP:
+        b0 = (1.0 + cw) * 0.5;
+        b1 = -(1.0 + cw);
+        b2 = b0;
+        break;
+    case BIQUAD_BP:
+        // Constant 0 dB peak gain
+        b0 = alpha;
+        b1 = 0.0;
+        b2 = -alpha;
+        break;
+    default:
+        b0 = (1.0 - cw) * 0.5;
+        b1 = 1.0 - cw;
+        b2 = b0;
+        break;
+    }
+    double a0 = 1.0 + alpha;
+    bq->b0 = b0 / a0;
+    bq->b1 = b1 / a0;
+    bq->b2 = b2 / a0;
+    bq->a1 = -2.0 * cw / a0;
+    bq->a2 = (1.0 - alpha) / a0;
+}
+
+float biquad_process(Biquad *bq, float x) {
+    double y = bq->b0 * x + bq->z1;
+    bq->z1 = flush(bq->b1 * x - bq->a1 * y + bq->z2);
+    bq->z2 = flush(bq->b2 * x - bq->a2 * y);
+    return (float)y;
+}
+
+void biquad_block(Biquad *bq, float *buf, int n) {
+    double b0 = bq->b0, b1 = bq->b1, b2 = bq->b2, a1 = bq->a1, a2 = bq->a2;
+    double z1 = bq->z1, z2 = bq->z2;
+    for (int i = 0; i < n; i++) {
+        double x = buf[i];
+        double y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        buf[i] = (float)y;
+    }
+    bq->z1 = flush(z1);
+    bq->z2 = flush(z2);
+}
+
+// Delay
+
+static unsigned int delay_size(double max_time, double sample_rate) {
+    double want = max_time * sample_rate + 2.0;
+    unsigned int size = 2;
+    while (size < want && size < (1u << 30)) {
+        size <<= 1;
+    }
+    return size;
+}
+
+size_t delay_bytes(double max_time, double sample_rate) {
+    return sizeof(Delay) + delay_size(max_time, sample_rate) * sizeof(float);
+}
+
+void delay_init(Delay *d, double max_time, double time, float feedback, double sample_rate) {
+    d->size = delay_size(max_time, sample_rate);
+    d->pos = 0;
+    d->feedback = feedback;
+    memset(d->buf, 0, d->size * sizeof(float));
+    delay_set_time(d, time, sample_rate);
+}
+
+void delay_set_time(Delay *d, double time, double sample_rate) {
+    double samples = time * sample_rate;
+    if (samples < 1.0) samples = 1.0;
+    if (samples > d->size - 2) samples = d->size - 2;
+    d->time = samples;
+}
+
+float delay_tap(const Delay *d, double samples) {
+    if (samples < 1.0) samples = 1.0;
+    if (samples > d->size - 2) samples = d->size - 2;
+    unsigned int whole = (unsigned int)samples;
+    float frac = (float)(samples - whole);
+    unsigned int mask = d->size - 1;
+    float a = d->buf[(d->pos - whole) & mask];
+    float b = d->buf[(d->pos - whole - 1) & mask];
+    return a + (b - a) * frac;
+}
+
+float delay_process(Delay *d, float x) {
+    float y = delay_tap(d, d->time);
+    d->buf[d->pos] = x + y * d->feedback;
+    d->pos = (d->pos + 1) & (d->size - 1);
+    return y;
+}
+
+void delay_block(Delay *d, float *buf, int n) {
+    for (int i = 0; i < n; i++) {
+        buf[i] = delay_process(d, buf[i]);
+    }
+}
+
+// Comb and allpass
+
+static unsigned int comb_len(double time, double sample_rate) {
+    double samples = floor(time * sample_rate + 0.5);
+    return samples < 1.0 ? 1u : (unsigned int)samples;
+}
+
+size_t comb_bytes(double time, double sample_rate) {
+    return sizeof(Comb) + comb_len(time, sample_rate) * sizeof(float);
+}
+
+void comb_init(Comb *c, int kind, double time, float gain, double sample_rate) {
+    c->kind = kind;
+    c->len = comb_len(time, sample_rate);
+    c->pos = 0;
+    c->gain = gain;
+    memset(c->buf, 0, c->len * sizeof(float));
+}
+
+float comb_process(Comb *c, float x) {
+    float delayed = c->buf[c->pos];
+    float y;
+    if (c->kind == COMB_ALLPASS) {
+        float v = x + c->gain * delayed;
+        y = delayed - c->gain * v;
+        c->buf[c->pos] = (float)flush(v);
+    } else {
+        y = x + c->gain * delayed;
+        c->buf[c->pos] = (float)flush(y);
+    }
+    if (++c->pos == c->len) {
+        c->pos = 0;
+    }
+    return y;
+}
+
+void comb_block(Comb *c, float *buf, int n) {
+    for (int i = 0; i < n; i++) {
+        buf[i] = comb_process(c, buf[i]);
+    }
+}
+
+// One-pole
+
+void onepole_init(OnePole *p, double freq, double sample_rate) {
+    p->y = 0.0;
+    onepole_set(p, freq, sample_rate);
+}
+
+void onepole_set(OnePole *p, double freq, double sample_rate) {
+    p->a = 1.0 - exp(-2.0 * M_PI * freq / sample_rate);
+}
+
+float onepole_process(OnePole *p, float x) {
+    p->y = flush(p->y + p->a * (x - p->y));
+    return (float)p->y;
+}
+
+void onepole_block(OnePole *p, float *buf, int n) {
+    double a = p->a, y = p->y;
+    for (int i = 0; i < n; i++) {
+        y += a * (buf[i] - y);
+        buf[i] = (float)y;
+    }
+    p->y = flush(y);
+}
+
+// ADSR
+
+// Level change per sample to cover 'range' in 'time' seconds
+static double adsr_rate(double range, double time, double sample_rate) {
+    double samples = time * sample_rate;
+    return samples < 1.0 ? range : range / samples;
+}
+
+void adsr_init(Adsr *env, double a, double d, double s, double r, double sample_rate) {
+    if (s < 0.0) s = 0.0;
+    if (s > 1.0) s = 1.0;
+    env->stage = ADSR_IDLE;
+    env->level = 0.0;
+    env->sustain = s;
+    env->attack = adsr_rate(1.0, a, sample_rate);
+    env->decay = adsr_rate(1.0 - s, d, sample_rate);
+    env->release = r * sample_rate;
+    env->step = 0.0;
+}
+
+void adsr_gate(Adsr *env, int on) {
+    if (on) {
+        // Retrigger from the current level, without a click
+        env->stage = ADSR_ATTACK;
+    } else if (env->stage != ADSR_IDLE && env->stage != ADSR_RELEASE) {
+        env->stage = ADSR_RELEASE;
+        env->step = env->release < 1.0 ? env->level : env->level / env->release;
+    }
+}
+
+float adsr_next(Adsr *env) {
+    switch (env->stage) {
+    case ADSR_ATTACK:
+        env->level += env->attack;
+        if (env->level >= 1.0) {
+            env->level = 1.0;
+            env->stage = ADSR_DECAY;
+        }
+        break;
+    case ADSR_DECAY:
+        env->level -= env->decay;
+        if (env->level <= env->sustain) {
+            env->level = env->sustain;
+            env->stage = ADSR_SUSTAIN;
+        }
+        break;
+    case ADSR_RELEASE:
+        env->level -= env->step;
+        if (env->level <= 0.0) {
+            env->level = 0.0;
+            env->stage = ADSR_IDLE;
+        }
+        break;
+    default:
+        break;
+    }
+    return (float)env->level;
+}
+
+float adsr_process(Adsr *env, float x) {
+    return x * adsr_next(env);
+}
+
+void adsr_block(Adsr *env, float *buf, int n) {
+    for (int i = 0; i < n; i++) {
+        buf[i] *= adsr_next(env);
+    }
+}
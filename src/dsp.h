@@ -0,0 +1,111 @@
+#ifndef DSP_H
+#define DSP_H
+
+#include <stddef.h>
+
+// DSP units for scripts: filters, delays and envelopes. Each unit keeps
+// all its state in its struct (delay lines carry their buffer at the
+// end), so a unit is allocated once when the script creates it and
+// processing never allocates. Every unit has a per-sample *_process and
+// an in-place *_block over n samples; times are in seconds and
+// frequencies in Hz.
+
+// Biquad filter (RBJ cookbook), transposed direct form II in double
+// precision so low cutoffs stay stable
+enum {
+    BIQUAD_LP = 0,
+    BIQUAD_HP,
+    BIQUAD_BP
+};
+
+typedef struct Biquad {
+    int kind;
+    double b0, b1, b2, a1, a2;
+    double z1, z2;
+} Biquad;
+
+void biquad_init(Biquad *bq, int kind, double freq, double q, double sample_rate);
+// New cutoff and Q, keeping the filter state so sweeps don't click
+void biquad_set(Biquad *bq, double freq, double q, double sample_rate);
+float biquad_process(Biquad *bq, float x);
+void biquad_block(Biquad *bq, float *buf, int n);
+
+// Delay line with feedback. The delay time is fractional and read with
+// linear interpolation, so it can be modulated smoothly.
+typedef struct Delay {
+    unsigned int size;        // power of two, in samples
+    unsigned int pos;         // next write position
+    double time;              // delay of process(), in samples
+    float feedback;
+    float buf[];
+} Delay;
+
+// Bytes needed for a Delay holding up to max_time seconds
+size_t delay_bytes(double max_time, double sample_rate);
+void delay_init(Delay *d, double max_time, double time, float feedback, double sample_rate);
+void delay_set_time(Delay *d, double time, double sample_rate);
+// Sample written 'samples' ago (at least 1, clamped to the line)
+float delay_tap(const Delay *d, double samples);
+// Return the delayed sample and write x plus the fed back output
+float delay_process(Delay *d, float x);
+void delay_block(Delay *d, float *buf, int n);
+
+// Feedback comb (y = x + g * y[n - D]) and Schroeder allpass
+// (y = -g * x + x[n - D] + g * y[n - D]) over a fixed whole-sample delay,
+// the building blocks of reverbs
+enum {
+    COMB_COMB = 0,
+    COMB_ALLPASS
+};
+
+typedef struct Comb {
+    int kind;
+    unsigned int len;         // delay in samples, at least 1
+    unsigned int pos;
+    float gain;
+    float buf[];
+} Comb;
+
+size_t comb_bytes(double time, double sample_rate);
+void comb_init(Comb *c, int kind, double time, float gain, double sample_rate);
+float comb_process(Comb *c, float x);
+void comb_block(Comb *c, float *buf, int n);
+
+// One-pole lowpass, for smoothing parameters and gentle filtering
+typedef struct OnePole {
+    double a;                 // 1 - exp(-2 pi freq / rate)
+    double y;
+} OnePole;
+
+void onepole_init(OnePole *p, double freq, double sample_rate);
+void onepole_set(OnePole *p, double freq, double sample_rate);
+float onepole_process(OnePole *p, float x);
+void onepole_block(OnePole *p, float *buf, int n);
+
+// ADSR envelope with linear segments. adsr_gate opens or closes it
+// (closing one that is already releasing changes nothing); adsr_process
+// multiplies its input by the envelope and advances it.
+enum {
+    ADSR_IDLE = 0,
+    ADSR_ATTACK,
+    ADSR_DECAY,
+    ADSR_SUSTAIN,
+    ADSR_RELEASE
+};
+
+typedef struct Adsr {
+    int stage;
+    double level;
+    double attack, decay;     // level change per sample
+    double sustain;
+    double release;           // samples to fade out from wherever the gate closed
+    double step;              // level change per sample while releasing
+} Adsr;
+
+void adsr_init(Adsr *env, double a, double d, double s, double r, double sample_rate);
+void adsr_gate(Adsr *env, int on);
+float adsr_next(Adsr *env);
+float adsr_process(Adsr *env, float x);
+void adsr_block(Adsr *env, float *buf, int n);
+
+#endif // DSP_H
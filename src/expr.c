@@ -0,0 +1,465 @@
+#define _USE_MATH_DEFINES
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <math.h>
+#include "expr.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Samples evaluated per pass over the bytecode. Every instruction runs
+// over this many lanes at once, so dispatch is paid once per lane group
+// and the arithmetic loops vectorize.
+#define EXPR_LANES 64
+#define EXPR_MAX_CODE 1024
+#define EXPR_MAX_DEPTH 64
+#define EXPR_DEFAULT_RATE 8000.0
+
+enum {
+    // Push
+    OP_T = 0, OP_TIME, OP_CONST,
+    // Unary
+    OP_NEG, OP_NOT, OP_BNOT, OP_SIN, OP_COS, OP_TAN, OP_ABS, OP_FLOOR, OP_SQRT,
+    // Binary
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_AND, OP_OR, OP_XOR, OP_SHL, OP_SHR,
+    OP_LT, OP_GT, OP_LE, OP_GE, OP_EQ, OP_NE, OP_LAND, OP_LOR, OP_MIN, OP_MAX, OP_POW,
+    OP_OSC_SIN, OP_OSC_SAW, OP_OSC_SQ, OP_OSC_TRI,
+    // Ternary
+    OP_SELECT
+};
+
+typedef struct Instr {
+    int op;
+    double value;             // OP_CONST
+} Instr;
+
+struct Expr {
+    double rate;              // rate t counts at
+    int floating;             // output the value, not bytebeat's low byte
+    int count;
+    int depth;                // stack slots the code needs
+    Instr code[EXPR_MAX_CODE];
+    double stack[(EXPR_MAX_DEPTH + 1) * EXPR_LANES];  // slot 0 stays unused
+};
+
+// Compiler
+
+typedef struct Parser {
+    const char *src;
+    const char *p;
+    Expr *expr;
+    int depth;                // stack slots in use at this point of the code
+    int nesting;              // parse_expr recursion, bounded to protect the C stack
+    char *err;
+    size_t err_size;
+    int failed;
+} Parser;
+
+static void fail(Parser *ps, const char *fmt, ...) {
+    if (ps->failed) {
+        return;
+    }
+    ps->failed = 1;
+    // Line and column of the error
+    int line = 1, col = 1;
+    for (const char *c = ps->src; c < ps->p; c++) {
+        if (*c == '\n') {
+            line++;
+            col = 1;
+        } else {
+            col++;
+        }
+    }
+    int len = snprintf(ps->err, ps->err_size, "%d:%d: ", line, col);
+    if (len < 0 || (size_t)len >= ps->err_size) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(ps->err + len, ps->err_size - (size_t)len, fmt, args);
+    va_end(args);
+}
+
+// Append an instruction that pops 'pops' slots and pushes one
+static void emit(Parser *ps, int op, double value, int pops) {
+    Expr *e = ps->expr;
+    if (e->count == EXPR_MAX_CODE) {
+        fail(ps, "expression too long");
+        return;
+    }
+    e->code[e->count].op = op;
+    e->code[e->count].value = value;
+    e->count++;
+    ps->depth += 1 - pops;
+    if (ps->depth > EXPR_MAX_DEPTH) {
+        fail(ps, "expression nested too deeply");
+    } else if (ps->depth > e->depth) {
+        e->depth = ps->depth;
+    }
+}
+
+// Directive line: "#rate <Hz>" or "#float"
+static void directive(Parser *ps) {
+    const char *p = ps->p + 1;
+    if (strncmp(p, "rate", 4) == 0 && isspace((unsigned char)p[4])) {
+        char *end;
+        double rate = strtod(p + 4, &end);
+        if (end == p + 4 || rate <= 0.0) {
+            fail(ps, "#rate needs a positive number");
+        }
+        ps->expr->rate = rate;
+    } else if (strncmp(p, "float", 5) == 0 && !isalnum((unsigned char)p[5])) {
+        ps->expr->floating = 1;
+    } else {
+        fail(ps, "unknown directive");
+    }
+    while (*ps->p && *ps->p != '\n') {
+        ps->p++;
+    }
+}
+
+// Skip whitespace, comments and directives
+static void skip(Parser *ps) {
+    for (;;) {
+        const char *p = ps->p;
+        if (isspace((unsigned char)*p)) {
+            ps->p++;
+        } else if (p[0] == '/' && p[1] == '/') {
+            while (*ps->p && *ps->p != '\n') ps->p++;
+        } else if (p[0] == '/' && p[1] == '*') {
+            const char *end = strstr(p + 2, "*/");
+            if (!end) {
+                fail(ps, "unterminated comment");
+                ps->p += strlen(ps->p);
+                return;
+            }
+            ps->p = end + 2;
+        } else if (p[0] == '#' && (p == ps->src || p[-1] == '\n')) {
+            directive(ps);
+        } else {
+            return;
+        }
+    }
+}
+
+// Consume the operator tok if it comes next (and isn't the start of a
+// longer one, e.g. '<' in '<<' or '&' in '&&')
+static int accept(Parser *ps, const char *tok) {
+    skip(ps);
+    size_t len = strlen(tok);
+    if (strncmp(ps->p, tok, len) != 0) {
+        return 0;
+    }
+    char next = ps->p[len];
+    if (len == 1 && ((tok[0] == '<' && (next == '<' || next == '=')) ||
+                     (tok[0] == '>' && (next == '>' || next == '=')) ||
+                     (tok[0] == '&' && next == '&') || (tok[0] == '|' && next == '|') ||
+                     (tok[0] == '!' && next == '=') || (tok[0] == '=' && next == '='))) {
+        return 0;
+    }
+    ps->p += len;
+    return 1;
+}
+
+static void expect(Parser *ps, const char *tok) {
+    if (!accept(ps, tok)) {
+        fail(ps, "expected '%s'", tok);
+    }
+}
+
+static void parse_expr(Parser *ps);
+
+static const struct {
+    const char *name;
+    int args;
+    int op;
+} functions[] = {
+    {"sin", 1, OP_SIN}, {"cos", 1, OP_COS}, {"tan", 1, OP_TAN}, {"abs", 1, OP_ABS},
+    {"floor", 1, OP_FLOOR}, {"sqrt", 1, OP_SQRT},
+    {"min", 2, OP_MIN}, {"max", 2, OP_MAX}, {"pow", 2, OP_POW},
+    {"sin", 2, OP_OSC_SIN}, {"saw", 2, OP_OSC_SAW}, {"sq", 2, OP_OSC_SQ}, {"tri", 2, OP_OSC_TRI},
+};
+
+static void parse_primary(Parser *ps) {
+    skip(ps);
+    const char *p = ps->p;
+    if (isdigit((unsigned char)*p) || (*p == '.' && isdigit((unsigned char)p[1]))) {
+        char *end;
+        double value = (p[0] == '0' && (p[1] == 'x' || p[1] == 'X'))
+                           ? (double)strtoull(p, &end, 16) : strtod(p, &end);
+        ps->p = end;
+        emit(ps, OP_CONST, value, 0);
+    } else if (isalpha((unsigned char)*p) || *p == '_') {
+        const char *start = p;
+        while (isalnum((unsigned char)*ps->p) || *ps->p == '_') ps->p++;
+        size_t len = (size_t)(ps->p - start);
+        char name[32];
+        if (len >= sizeof(name)) {
+            fail(ps, "unknown name");
+            return;
+        }
+        memcpy(name, start, len);
+        name[len] = '\0';
+
+        if (accept(ps, "(")) {
+            int args = 0;
+            if (!accept(ps, ")")) {
+                do {
+                    parse_expr(ps);
+                    args++;
+                } while (accept(ps, ","));
+                expect(ps, ")");
+            }
+            for (size_t i = 0; i < sizeof(functions) / sizeof(functions[0]); i++) {
+                if (strcmp(functions[i].name, name) == 0 && functions[i].args == args) {
+                    emit(ps, functions[i].op, 0.0, args);
+                    return;
+                }
+            }
+            ps->p = start;
+            fail(ps, "unknown function %s with %d argument%s", name, args, args == 1 ? "" : "s");
+        } else if (strcmp(name, "t") == 0) {
+            emit(ps, OP_T, 0.0, 0);
+        } else if (strcmp(name, "time") == 0) {
+            emit(ps, OP_TIME, 0.0, 0);
+        } else if (strcmp(name, "pi") == 0) {
+            emit(ps, OP_CONST, M_PI, 0);
+        } else {
+            ps->p = start;
+            fail(ps, "unknown name '%s'", name);
+        }
+    } else if (accept(ps, "(")) {
+        parse_expr(ps);
+        expect(ps, ")");
+    } else {
+        fail(ps, *p ? "unexpected '%c'" : "unexpected end of expression", *p);
+    }
+}
+
+static void parse_unary(Parser *ps) {
+    // Prefix operators apply innermost first
+    int ops[EXPR_MAX_DEPTH];
+    int count = 0;
+    while (!ps->failed) {
+        int op;
+        if (accept(ps, "-")) {
+            op = OP_NEG;
+        } else if (accept(ps, "!")) {
+            op = OP_NOT;
+        } else if (accept(ps, "~")) {
+            op = OP_BNOT;
+        } else if (accept(ps, "+")) {
+            continue;
+        } else {
+            break;
+        }
+        if (count == EXPR_MAX_DEPTH) {
+            fail(ps, "too many prefix operators");
+            return;
+        }
+        ops[count++] = op;
+    }
+    parse_primary(ps);
+    while (count > 0) {
+        emit(ps, ops[--count], 0.0, 1);
+    }
+}
+
+// Binary operators by precedence, loosest first
+static const struct {
+    const char *tok;
+    int op;
+} levels[][6] = {
+    {{"||", OP_LOR}},
+    {{"&&", OP_LAND}},
+    {{"|", OP_OR}},
+    {{"^", OP_XOR}},
+    {{"&", OP_AND}},
+    {{"==", OP_EQ}, {"!=", OP_NE}},
+    {{"<=", OP_LE}, {">=", OP_GE}, {"<", OP_LT}, {">", OP_GT}},
+    {{"<<", OP_SHL}, {">>", OP_SHR}},
+    {{"+", OP_ADD}, {"-", OP_SUB}},
+    {{"*", OP_MUL}, {"/", OP_DIV}, {"%", OP_MOD}},
+};
+#define LEVEL_COUNT ((int)(sizeof(levels) / sizeof(levels[0])))
+
+static void parse_binary(Parser *ps, int level) {
+    if (level == LEVEL_COUNT) {
+        parse_unary(ps);
+        return;
+    }
+    parse_binary(ps, level + 1);
+    while (!ps->failed) {
+        int op = -1;
+        for (int i = 0; i < 6 && levels[level][i].tok; i++) {
+            if (accept(ps, levels[level][i].tok)) {
+                op = levels[level][i].op;
+                break;
+            }
+        }
+        if (op < 0) {
+            return;
+        }
+        parse_binary(ps, level + 1);
+        emit(ps, op, 0.0, 2);
+    }
+}
+
+static void parse_expr(Parser *ps) {
+    if (++ps->nesting > EXPR_MAX_DEPTH) {
+        fail(ps, "expression nested too deeply");
+        ps->nesting--;
+        return;
+    }
+    parse_binary(ps, 0);
+    if (accept(ps, "?")) {
+        parse_expr(ps);
+        expect(ps, ":");
+        parse_expr(ps);
+        emit(ps, OP_SELECT, 0.0, 3);
+    }
+    ps->nesting--;
+}
+
+Expr *expr_compile(const char *source, char *err, size_t err_size) {
+    Expr *expr = (Expr *)calloc(1, sizeof(Expr));
+    if (!expr) {
+        snprintf(err, err_size, "out of memory");
+        return NULL;
+    }
+    expr->rate = EXPR_DEFAULT_RATE;
+
+    Parser ps = {source, source, expr, 0, 0, err, err_size, 0};
+    parse_expr(&ps);
+    skip(&ps);
+    if (!ps.failed && *ps.p) {
+        fail(&ps, "unexpected '%c'", *ps.p);
+    }
+    if (ps.failed) {
+        free(expr);
+        return NULL;
+    }
+    return expr;
+}
+
+void expr_set_rate(Expr *expr, double rate) {
+    if (rate > 0.0) {
+        expr->rate = rate;
+    }
+}
+
+void expr_set_float(Expr *expr, int floating) {
+    expr->floating = floating;
+}
+
+// Evaluator
+
+// JavaScript ToInt32: truncate, then wrap modulo 2^32
+static inline int32_t to_i32(double x) {
+    if (!(fabs(x) < 9.2e18)) {
+        return 0;
+    }
+    return (int32_t)(uint32_t)(int64_t)x;
+}
+
+static inline double frac(double x) {
+    return x - floor(x);
+}
+
+#define UNARY(expr) \
+    for (int i = 0; i < len; i++) { double x = sp[i]; sp[i] = (expr); } \
+    break
+#define BINARY(expr) \
+    sp -= EXPR_LANES; \
+    for (int i = 0; i < len; i++) { double x = sp[i], y = sp[i + EXPR_LANES]; sp[i] = (expr); } \
+    break
+
+void expr_eval(Expr *expr, float *out, int n, unsigned long long frame, int sample_rate) {
+    const double ratio = expr->rate / sample_rate;
+    const double dt = 1.0 / sample_rate;
+
+    for (int start = 0; start < n; start += EXPR_LANES) {
+        const int len = n - start < EXPR_LANES ? n - start : EXPR_LANES;
+        const double first = (double)(frame + (unsigned long long)start);
+        double *sp = expr->stack;  // top of the stack
+
+        for (int pc = 0; pc < expr->count; pc++) {
+            const Instr *in = &expr->code[pc];
+            switch (in->op) {
+            case OP_T:
+                sp += EXPR_LANES;
+                for (int i = 0; i < len; i++) sp[i] = floor((first + i) * ratio);
+                break;
+            case OP_TIME:
+                sp += EXPR_LANES;
+                for (int i = 0; i < len; i++) sp[i] = (first + i) * dt;
+                break;
+            case OP_CONST:
+                sp += EXPR_LANES;
+                for (int i = 0; i < len; i++) sp[i] = in->value;
+                break;
+            case OP_NEG: UNARY(-x);
+            case OP_NOT: UNARY(x == 0.0 ? 1.0 : 0.0);
+            case OP_BNOT: UNARY((double)~to_i32(x));
+            case OP_SIN: UNARY(sin(x));
+            case OP_COS: UNARY(cos(x));
+            case OP_TAN: UNARY(tan(x));
+            case OP_ABS: UNARY(fabs(x));
+            case OP_FLOOR: UNARY(floor(x));
+            case OP_SQRT: UNARY(sqrt(x));
+            case OP_ADD: BINARY(x + y);
+            case OP_SUB: BINARY(x - y);
+            case OP_MUL: BINARY(x * y);
+            case OP_DIV: BINARY(x / y);
+            case OP_MOD: BINARY(fmod(x, y));
+            case OP_AND: BINARY((double)(to_i32(x) & to_i32(y)));
+            case OP_OR: BINARY((double)(to_i32(x) | to_i32(y)));
+            case OP_XOR: BINARY((double)(to_i32(x) ^ to_i32(y)));
+            case OP_SHL: BINARY((double)(int32_t)((uint32_t)to_i32(x) << (to_i32(y) & 31)));
+            case OP_SHR: BINARY((double)(to_i32(x) >> (to_i32(y) & 31)));
+            case OP_LT: BINARY(x < y ? 1.0 : 0.0);
+            case OP_GT: BINARY(x > y ? 1.0 : 0.0);
+            case OP_LE: BINARY(x <= y ? 1.0 : 0.0);
+            case OP_GE: BINARY(x >= y ? 1.0 : 0.0);
+            case OP_EQ: BINARY(x == y ? 1.0 : 0.0);
+            case OP_NE: BINARY(x != y ? 1.0 : 0.0);
+            case OP_LAND: BINARY(x != 0.0 && y != 0.0 ? 1.0 : 0.0);
+            case OP_LOR: BINARY(x != 0.0 || y != 0.0 ? 1.0 : 0.0);
+            case OP_MIN: BINARY(x < y ? x : y);
+            case OP_MAX: BINARY(x > y ? x : y);
+            case OP_POW: BINARY(pow(x, y));
+            // Same waveforms as chip.sin/saw/sq/tri(time, freq)
+            case OP_OSC_SIN: BINARY(sin(2.0 * M_PI * y * x));
+            case OP_OSC_SAW: BINARY(2.0 * (y * x - floor(0.5 + y * x)));
+            case OP_OSC_SQ: BINARY(frac(y * x) < 0.5 ? 1.0 : -1.0);
+            case OP_OSC_TRI: BINARY(1.0 - 4.0 * fabs(round(frac(y * x) - 0.25) - (frac(y * x) - 0.25)));
+            case OP_SELECT:
+                sp -= 2 * EXPR_LANES;
+                for (int i = 0; i < len; i++) {
+                    sp[i] = sp[i] != 0.0 ? sp[i + EXPR_LANES] : sp[i + 2 * EXPR_LANES];
+                }
+                break;
+            }
+        }
+
+        float *o = out + start;
+        if (expr->floating) {
+            for (int i = 0; i < len; i++) {
+                o[i] = sp[i] == sp[i] ? (float)sp[i] : 0.0f;
+            }
+        } else {
+            for (int i = 0; i < len; i++) {
+                o[i] = (float)((to_i32(sp[i]) & 255) - 128) * (1.0f / 128.0f);
+            }
+        }
+    }
+}
+
+void expr_free(Expr *expr) {
+    free(expr);
+}
@@ -0,0 +1,34 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stddef.h>
+
+// Bytebeat expressions compiled to a stack bytecode and evaluated in C
+// over whole blocks, without Lua. The language is a C/JavaScript-style
+// expression over
+//   t      sample counter at the expression's rate (8000 Hz by default)
+//   time   seconds since the start
+//   pi
+// with + - * / % (floating point, as in JavaScript), the bitwise
+// & | ^ ~ << >> (on 32-bit integers), comparisons, ! && || and ?:,
+// sin cos tan abs floor sqrt (one argument), min max pow (two), and the
+// chip oscillators sin saw sq tri (time, freq). Comments are // and /* */.
+// Lines starting with '#' are directives: "#rate <Hz>" sets the rate t
+// counts at, "#float" outputs the value as a sample instead of the classic
+// bytebeat (value & 255) scaled to [-1, 1).
+
+typedef struct Expr Expr;
+
+// Compile source; NULL on error, with a message in err
+Expr *expr_compile(const char *source, char *err, size_t err_size);
+
+// Override the directives
+void expr_set_rate(Expr *expr, double rate);
+void expr_set_float(Expr *expr, int floating);
+
+// Evaluate n samples starting at frame into out (mono)
+void expr_eval(Expr *expr, float *out, int n, unsigned long long frame, int sample_rate);
+
+void expr_free(Expr *expr);
+
+#endif // EXPR_H
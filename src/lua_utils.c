@@ -3,10 +3,21 @@
 #include <lauxlib.h>
 #include <lualib.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <stdint.h>
 #include "audio.h"
+#include "script.h"
+#include "sample_cache.h"
+#include "osc_block.h"
+#include "noise.h"
+#include "dsp.h"
+#include "wavetable.h"
+#include "expr.h"
+#include "record.h"
+#include "stats.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -19,16 +30,16 @@
 #endif
 #endif
 
-// Global time variable
-extern AudioState audio_state;
+// Script a chip function belongs to, held as its first upvalue
+#define script_of(L) ((Script *)lua_touserdata(L, lua_upvalueindex(1)))
 
 // Helper function to get time value from Lua stack
 static double get_time(lua_State *L, int index) {
     if (lua_isnumber(L, index)) {
         return lua_tonumber(L, index);
     }
-    // If no time is provided, use the internal time
-    return audio_state.time;
+    // If no time is provided, use the script's current time
+    return script_of(L)->time;
 }
 
 // sin(t, freq, phase)
@@ -76,32 +87,850 @@ int l_tri(lua_State *L) {
     return 1;
 }
 
-// spl(path, t)
+// Samples converted per chunk when filling a Lua table from a kernel
+#define BLOCK_CHUNK 256
+
+// Fill buf[1..n] with a block kernel: (buf, t0, dt, freq, phase, n).
+// phase_scale converts the phase argument to cycles.
+static int fill_block(lua_State *L, void (*kernel)(float *, int, double, double),
+                      double phase_scale) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    double t0 = luaL_checknumber(L, 2);
+    double dt = luaL_checknumber(L, 3);
+    double freq = luaL_checknumber(L, 4);
+    double phase = luaL_optnumber(L, 5, 0.0) * phase_scale;
+    int n = luaL_optint(L, 6, (int)lua_objlen(L, 1));
+    float chunk[BLOCK_CHUNK];
+
+    for (int start = 0; start < n; start += BLOCK_CHUNK) {
+        int len = n - start < BLOCK_CHUNK ? n - start : BLOCK_CHUNK;
+        kernel(chunk, len, freq * (t0 + start * dt) + phase, freq * dt);
+        for (int i = 0; i < len; i++) {
+            lua_pushnumber(L, chunk[i]);
+            lua_rawseti(L, 1, start + i + 1);
+        }
+    }
+    return 0;
+}
+
+// sinb(buf, t0, dt, freq, phase, n)
+int l_sinb(lua_State *L) {
+    return fill_block(L, osc_block_sin, 1.0 / (2.0 * M_PI));
+}
+
+// sawb(buf, t0, dt, freq, phase, n)
+int l_sawb(lua_State *L) {
+    return fill_block(L, osc_block_saw, 1.0);
+}
+
+// sqb(buf, t0, dt, freq, phase, n)
+int l_sqb(lua_State *L) {
+    return fill_block(L, osc_block_sq, 1.0);
+}
+
+// trib(buf, t0, dt, freq, phase, n)
+int l_trib(lua_State *L) {
+    return fill_block(L, osc_block_tri, 1.0);
+}
+
+static const char *const osc_kinds[] = {"sin", "saw", "sq", "tri", NULL};
+
+// osc(kind, freq)
+int l_osc(lua_State *L) {
+    int kind = luaL_checkoption(L, 1, NULL, osc_kinds);
+    double freq = luaL_checknumber(L, 2);
+    Osc *osc = (Osc *)lua_newuserdata(L, sizeof(Osc));
+    osc_init(osc, kind, freq, script_of(L)->sample_rate);
+    luaL_getmetatable(L, "chip.osc");
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+// osc:next()
+static int osc_next_method(lua_State *L) {
+    Osc *osc = (Osc *)luaL_checkudata(L, 1, "chip.osc");
+    lua_pushnumber(L, osc_next(osc));
+    return 1;
+}
+
+// osc:fill(buf, n)
+static int osc_fill_method(lua_State *L) {
+    Osc *osc = (Osc *)luaL_checkudata(L, 1, "chip.osc");
+    luaL_checktype(L, 2, LUA_TTABLE);
+    int n = luaL_optint(L, 3, (int)lua_objlen(L, 2));
+    float chunk[BLOCK_CHUNK];
+
+    for (int start = 0; start < n; start += BLOCK_CHUNK) {
+        int len = n - start < BLOCK_CHUNK ? n - start : BLOCK_CHUNK;
+        osc_fill(osc, chunk, len);
+        for (int i = 0; i < len; i++) {
+            lua_pushnumber(L, chunk[i]);
+            lua_rawseti(L, 2, start + i + 1);
+        }
+    }
+    return 0;
+}
+
+// osc:freq() or osc:freq(freq)
+static int osc_freq_method(lua_State *L) {
+    Osc *osc = (Osc *)luaL_checkudata(L, 1, "chip.osc");
+    if (lua_isnoneornil(L, 2)) {
+        lua_pushnumber(L, osc->inc * script_of(L)->sample_rate);
+        return 1;
+    }
+    osc_set_freq(osc, luaL_checknumber(L, 2), script_of(L)->sample_rate);
+    return 0;
+}
+
+// osc:reset(phase)
+static int osc_reset_method(lua_State *L) {
+    Osc *osc = (Osc *)luaL_checkudata(L, 1, "chip.osc");
+    double phase = luaL_optnumber(L, 2, 0.0);
+    osc->phase = phase - floor(phase);
+    return 0;
+}
+
+static const luaL_Reg osc_methods[] = {
+    {"next", osc_next_method},
+    {"fill", osc_fill_method},
+    {"freq", osc_freq_method},
+    {"reset", osc_reset_method},
+    {NULL, NULL}
+};
+
+// DSP units. Each is a userdata holding its whole state (delay lines
+// with their buffer), created once by its constructor; process(x) and
+// processBlock(buf, n) never allocate.
+
+// Run a block kernel in place over buf[1..n] (n defaults to #buf) of the
+// table at index 2
+static int process_table(lua_State *L, void *unit, void (*block)(void *, float *, int)) {
+    luaL_checktype(L, 2, LUA_TTABLE);
+    int n = luaL_optint(L, 3, (int)lua_objlen(L, 2));
+    float chunk[BLOCK_CHUNK];
+
+    for (int start = 0; start < n; start += BLOCK_CHUNK) {
+        int len = n - start < BLOCK_CHUNK ? n - start : BLOCK_CHUNK;
+        for (int i = 0; i < len; i++) {
+            lua_rawgeti(L, 2, start + i + 1);
+            chunk[i] = (float)lua_tonumber(L, -1);
+            lua_pop(L, 1);
+        }
+        block(unit, chunk, len);
+        for (int i = 0; i < len; i++) {
+            lua_pushnumber(L, chunk[i]);
+            lua_rawseti(L, 2, start + i + 1);
+        }
+    }
+    return 0;
+}
+
+static const char *const biquad_kinds[] = {"lp", "hp", "bp", NULL};
+
+// biquad(kind, freq, q)
+int l_biquad(lua_State *L) {
+    int kind = luaL_checkoption(L, 1, NULL, biquad_kinds);
+    double freq = luaL_checknumber(L, 2);
+    double q = luaL_optnumber(L, 3, 0.7071);
+    Biquad *bq = (Biquad *)lua_newuserdata(L, sizeof(Biquad));
+    biquad_init(bq, kind, freq, q, script_of(L)->sample_rate);
+    luaL_getmetatable(L, "chip.biquad");
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static int biquad_process_method(lua_State *L) {
+    Biquad *bq = (Biquad *)luaL_checkudata(L, 1, "chip.biquad");
+    lua_pushnumber(L, biquad_process(bq, (float)luaL_checknumber(L, 2)));
+    return 1;
+}
+
+static void biquad_block_unit(void *unit, float *buf, int n) {
+    biquad_block((Biquad *)unit, buf, n);
+}
+
+static int biquad_block_method(lua_State *L) {
+    return process_table(L, luaL_checkudata(L, 1, "chip.biquad"), biquad_block_unit);
+}
+
+// biquad:set(freq, q)
+static int biquad_set_method(lua_State *L) {
+    Biquad *bq = (Biquad *)luaL_checkudata(L, 1, "chip.biquad");
+    double freq = luaL_checknumber(L, 2);
+    double q = luaL_optnumber(L, 3, 0.7071);
+    biquad_set(bq, freq, q, script_of(L)->sample_rate);
+    return 0;
+}
+
+static int biquad_reset_method(lua_State *L) {
+    Biquad *bq = (Biquad *)luaL_checkudata(L, 1, "chip.biquad");
+    bq->z1 = bq->z2 = 0.0;
+    return 0;
+}
+
+static const luaL_Reg biquad_methods[] = {
+    {"process", biquad_process_method},
+    {"processBlock", biquad_block_method},
+    {"set", biquad_set_method},
+    {"reset", biquad_reset_method},
+    {NULL, NULL}
+};
+
+// delay(max_time, time, feedback)
+int l_delay(lua_State *L) {
+    double rate = script_of(L)->sample_rate;
+    double max_time = luaL_checknumber(L, 1);
+    double time = luaL_optnumber(L, 2, max_time);
+    float feedback = (float)luaL_optnumber(L, 3, 0.0);
+    luaL_argcheck(L, max_time > 0.0 && max_time <= 60.0, 1, "must be in (0, 60] seconds");
+    Delay *d = (Delay *)lua_newuserdata(L, delay_bytes(max_time, rate));
+    delay_init(d, max_time, time, feedback, rate);
+    luaL_getmetatable(L, "chip.delay");
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static int delay_process_method(lua_State *L) {
+    Delay *d = (Delay *)luaL_checkudata(L, 1, "chip.delay");
+    lua_pushnumber(L, delay_process(d, (float)luaL_checknumber(L, 2)));
+    return 1;
+}
+
+static void delay_block_unit(void *unit, float *buf, int n) {
+    delay_block((Delay *)unit, buf, n);
+}
+
+static int delay_block_method(lua_State *L) {
+    return process_table(L, luaL_checkudata(L, 1, "chip.delay"), delay_block_unit);
+}
+
+// delay:tap(time): the line 'time' seconds ago, interpolated
+static int delay_tap_method(lua_State *L) {
+    Delay *d = (Delay *)luaL_checkudata(L, 1, "chip.delay");
+    lua_pushnumber(L, delay_tap(d, luaL_checknumber(L, 2) * script_of(L)->sample_rate));
+    return 1;
+}
+
+// delay:time() or delay:time(time)
+static int delay_time_method(lua_State *L) {
+    Delay *d = (Delay *)luaL_checkudata(L, 1, "chip.delay");
+    if (lua_isnoneornil(L, 2)) {
+        lua_pushnumber(L, d->time / script_of(L)->sample_rate);
+        return 1;
+    }
+    delay_set_time(d, luaL_checknumber(L, 2), script_of(L)->sample_rate);
+    return 0;
+}
+
+// delay:feedback() or delay:feedback(amount)
+static int delay_feedback_method(lua_State *L) {
+    Delay *d = (Delay *)luaL_checkudata(L, 1, "chip.delay");
+    if (lua_isnoneornil(L, 2)) {
+        lua_pushnumber(L, d->feedback);
+        return 1;
+    }
+    d->feedback = (float)luaL_checknumber(L, 2);
+    return 0;
+}
+
+static const luaL_Reg delay_methods[] = {
+    {"process", delay_process_method},
+    {"processBlock", delay_block_method},
+    {"tap", delay_tap_method},
+    {"time", delay_time_method},
+    {"feedback", delay_feedback_method},
+    {NULL, NULL}
+};
+
+static int new_comb(lua_State *L, int kind) {
+    double rate = script_of(L)->sample_rate;
+    double time = luaL_checknumber(L, 1);
+    float gain = (float)luaL_optnumber(L, 2, 0.5);
+    luaL_argcheck(L, time > 0.0 && time <= 10.0, 1, "must be in (0, 10] seconds");
+    Comb *c = (Comb *)lua_newuserdata(L, comb_bytes(time, rate));
+    comb_init(c, kind, time, gain, rate);
+    luaL_getmetatable(L, "chip.comb");
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+// comb(time, gain)
+int l_comb(lua_State *L) {
+    return new_comb(L, COMB_COMB);
+}
+
+// allpass(time, gain)
+int l_allpass(lua_State *L) {
+    return new_comb(L, COMB_ALLPASS);
+}
+
+static int comb_process_method(lua_State *L) {
+    Comb *c = (Comb *)luaL_checkudata(L, 1, "chip.comb");
+    lua_pushnumber(L, comb_process(c, (float)luaL_checknumber(L, 2)));
+    return 1;
+}
+
+static void comb_block_unit(void *unit, float *buf, int n) {
+    comb_block((Comb *)unit, buf, n);
+}
+
+static int comb_block_method(lua_State *L) {
+    return process_table(L, luaL_checkudata(L, 1, "chip.comb"), comb_block_unit);
+}
+
+// comb:gain() or comb:gain(gain)
+static int comb_gain_method(lua_State *L) {
+    Comb *c = (Comb *)luaL_checkudata(L, 1, "chip.comb");
+    if (lua_isnoneornil(L, 2)) {
+        lua_pushnumber(L, c->gain);
+        return 1;
+    }
+    c->gain = (float)luaL_checknumber(L, 2);
+    return 0;
+}
+
+static const luaL_Reg comb_methods[] = {
+    {"process", comb_process_method},
+    {"processBlock", comb_block_method},
+    {"gain", comb_gain_method},
+    {NULL, NULL}
+};
+
+// onepole(freq)
+int l_onepole(lua_State *L) {
+    double freq = luaL_checknumber(L, 1);
+    OnePole *p = (OnePole *)lua_newuserdata(L, sizeof(OnePole));
+    onepole_init(p, freq, script_of(L)->sample_rate);
+    luaL_getmetatable(L, "chip.onepole");
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static int onepole_process_method(lua_State *L) {
+    OnePole *p = (OnePole *)luaL_checkudata(L, 1, "chip.onepole");
+    lua_pushnumber(L, onepole_process(p, (float)luaL_checknumber(L, 2)));
+    return 1;
+}
+
+static void onepole_block_unit(void *unit, float *buf, int n) {
+    onepole_block((OnePole *)unit, buf, n);
+}
+
+static int onepole_block_method(lua_State *L) {
+    return process_table(L, luaL_checkudata(L, 1, "chip.onepole"), onepole_block_unit);
+}
+
+// onepole:freq(freq)
+static int onepole_freq_method(lua_State *L) {
+    OnePole *p = (OnePole *)luaL_checkudata(L, 1, "chip.onepole");
+    onepole_set(p, luaL_checknumber(L, 2), script_of(L)->sample_rate);
+    return 0;
+}
+
+static const luaL_Reg onepole_methods[] = {
+    {"process", onepole_process_method},
+    {"processBlock", onepole_block_method},
+    {"freq", onepole_freq_method},
+    {NULL, NULL}
+};
+
+// adsr(attack, decay, sustain, release)
+int l_adsr(lua_State *L) {
+    double a = luaL_checknumber(L, 1);
+    double d = luaL_checknumber(L, 2);
+    double s = luaL_checknumber(L, 3);
+    double r = luaL_checknumber(L, 4);
+    Adsr *env = (Adsr *)lua_newuserdata(L, sizeof(Adsr));
+    adsr_init(env, a, d, s, r, script_of(L)->sample_rate);
+    luaL_getmetatable(L, "chip.adsr");
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+static int adsr_process_method(lua_State *L) {
+    Adsr *env = (Adsr *)luaL_checkudata(L, 1, "chip.adsr");
+    lua_pushnumber(L, adsr_process(env, (float)luaL_checknumber(L, 2)));
+    return 1;
+}
+
+static void adsr_block_unit(void *unit, float *buf, int n) {
+    adsr_block((Adsr *)unit, buf, n);
+}
+
+static int adsr_block_method(lua_State *L) {
+    return process_table(L, luaL_checkudata(L, 1, "chip.adsr"), adsr_block_unit);
+}
+
+// adsr:next(): the envelope level, advancing one sample
+static int adsr_next_method(lua_State *L) {
+    Adsr *env = (Adsr *)luaL_checkudata(L, 1, "chip.adsr");
+    lua_pushnumber(L, adsr_next(env));
+    return 1;
+}
+
+// adsr:gate(on): start the attack, or the release when on is false
+static int adsr_gate_method(lua_State *L) {
+    Adsr *env = (Adsr *)luaL_checkudata(L, 1, "chip.adsr");
+    adsr_gate(env, lua_isnone(L, 2) || lua_toboolean(L, 2));
+    return 0;
+}
+
+static const luaL_Reg adsr_methods[] = {
+    {"process", adsr_process_method},
+    {"processBlock", adsr_block_method},
+    {"next", adsr_next_method},
+    {"gate", adsr_gate_method},
+    {NULL, NULL}
+};
+
+// Control-rate function: fn(t) is evaluated once every 'period' samples
+// and the values in between are interpolated, linearly or exponentially
+typedef struct Kr {
+    int period;
+    int exponential;
+    int sample_rate;
+    long long segment;        // period v0 and v1 bound, -1 before the first
+    double v0, v1;            // fn at the start and the end of it
+} Kr;
+
+static const char *const kr_modes[] = {"lin", "exp", NULL};
+
+// kr(fn, period, mode): the function is kept in the userdata's environment
+int l_kr(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    int period = luaL_optint(L, 2, 64);
+    luaL_argcheck(L, period >= 1, 2, "period must be at least 1 sample");
+    int mode = luaL_checkoption(L, 3, "lin", kr_modes);
+
+    Kr *kr = (Kr *)lua_newuserdata(L, sizeof(Kr));
+    kr->period = period;
+    kr->exponential = mode == 1;
+    kr->sample_rate = script_of(L)->sample_rate;
+    kr->segment = -1;
+    kr->v0 = kr->v1 = 0.0;
+    luaL_getmetatable(L, "chip.kr");
+    lua_setmetatable(L, -2);
+    lua_createtable(L, 1, 0);
+    lua_pushvalue(L, 1);
+    lua_rawseti(L, -2, 1);
+    lua_setfenv(L, -2);
+    return 1;
+}
+
+// fn of the kr at index 1, at frame
+static double kr_eval(lua_State *L, const Kr *kr, long long frame) {
+    lua_getfenv(L, 1);
+    lua_rawgeti(L, -1, 1);
+    lua_remove(L, -2);
+    lua_pushnumber(L, (double)frame / kr->sample_rate);
+    lua_call(L, 1, 1);
+    double v = lua_tonumber(L, -1);
+    lua_pop(L, 1);
+    return v;
+}
+
+// Make the period holding frame current, calling fn once per period when
+// time runs forward
+static void kr_seek(lua_State *L, Kr *kr, long long frame) {
+    long long segment = frame / kr->period;
+    if (segment == kr->segment) {
+        return;
+    }
+    long long start = segment * kr->period;
+    kr->v0 = segment == kr->segment + 1 ? kr->v1 : kr_eval(L, kr, start);
+    kr->v1 = kr_eval(L, kr, start + kr->period);
+    kr->segment = segment;
+}
+
+// Value 'offset' samples into the current period. Exponential
+// interpolation needs both ends on the same side of 0, otherwise it is
+// linear.
+static double kr_at(const Kr *kr, int offset) {
+    double x = (double)offset / kr->period;
+    if (kr->exponential && kr->v0 * kr->v1 > 0.0) {
+        return kr->v0 * pow(kr->v1 / kr->v0, x);
+    }
+    return kr->v0 + (kr->v1 - kr->v0) * x;
+}
+
+static long long kr_frame(lua_State *L, const Kr *kr, int index) {
+    double frame = floor(get_time(L, index) * kr->sample_rate + 0.5);
+    return frame > 0.0 ? (long long)frame : 0;
+}
+
+// kr:value(t): the interpolated value at t (default: now)
+static int kr_value_method(lua_State *L) {
+    Kr *kr = (Kr *)luaL_checkudata(L, 1, "chip.kr");
+    long long frame = kr_frame(L, kr, 2);
+    kr_seek(L, kr, frame);
+    lua_pushnumber(L, kr_at(kr, (int)(frame - kr->segment * kr->period)));
+    return 1;
+}
+
+// kr:fill(buf, n, t): write the values of n samples from t (default: now)
+// into buf[1] to buf[n], stepping through each period without calling pow
+static int kr_fill_method(lua_State *L) {
+    Kr *kr = (Kr *)luaL_checkudata(L, 1, "chip.kr");
+    luaL_checktype(L, 2, LUA_TTABLE);
+    int n = luaL_optint(L, 3, (int)lua_objlen(L, 2));
+    long long frame = kr_frame(L, kr, 4);
+
+    for (int i = 0; i < n;) {
+        kr_seek(L, kr, frame + i);
+        int offset = (int)(frame + i - kr->segment * kr->period);
+        int len = kr->period - offset;
+        if (len > n - i) len = n - i;
+        double v = kr_at(kr, offset);
+        int exponential = kr->exponential && kr->v0 * kr->v1 > 0.0;
+        double step = exponential ? pow(kr->v1 / kr->v0, 1.0 / kr->period)
+                                  : (kr->v1 - kr->v0) / kr->period;
+        for (int j = 0; j < len; j++) {
+            lua_pushnumber(L, v);
+            lua_rawseti(L, 2, i + j + 1);
+            v = exponential ? v * step : v + step;
+        }
+        i += len;
+    }
+    return 0;
+}
+
+static const luaL_Reg kr_methods[] = {
+    {"value", kr_value_method},
+    {"fill", kr_fill_method},
+    {NULL, NULL}
+};
+
+// expr(code, opts): compile a bytebeat expression. Returned from a script,
+// it is rendered in C without calling Lua. opts.rate and opts.float
+// override the #rate and #float directives.
+int l_expr(lua_State *L) {
+    const char *code = luaL_checkstring(L, 1);
+    char err[128];
+    Expr *expr = expr_compile(code, err, sizeof(err));
+    if (!expr) {
+        return luaL_error(L, "expr: %s", err);
+    }
+    Expr **ud = (Expr **)lua_newuserdata(L, sizeof(Expr *));
+    *ud = expr;
+    luaL_getmetatable(L, "chip.expr");
+    lua_setmetatable(L, -2);
+
+    if (lua_istable(L, 2)) {
+        lua_getfield(L, 2, "rate");
+        if (lua_isnumber(L, -1)) {
+            expr_set_rate(expr, lua_tonumber(L, -1));
+        }
+        lua_getfield(L, 2, "float");
+        if (!lua_isnil(L, -1)) {
+            expr_set_float(expr, lua_toboolean(L, -1));
+        }
+        lua_pop(L, 2);
+    }
+    return 1;
+}
+
+static int expr_gc(lua_State *L) {
+    Expr **ud = (Expr **)luaL_checkudata(L, 1, "chip.expr");
+    expr_free(*ud);
+    *ud = NULL;
+    return 0;
+}
+
+// Ref the callback at index and return the id of the event made from it
+static int schedule(lua_State *L, int index, double origin, double period, int steps, int length) {
+    Script *script = script_of(L);
+    luaL_checktype(L, index, LUA_TFUNCTION);
+    lua_pushvalue(L, index);
+    int fn = luaL_ref(L, LUA_REGISTRYINDEX);
+    int id = script_schedule(script, origin, period, fn, steps, length);
+    if (id == 0) {
+        return luaL_error(L, "cannot schedule any more events");
+    }
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+// First sample of a periodic event: start (in seconds) if given, otherwise
+// the next multiple of the period, so events line up on a common grid
+static double periodic_origin(lua_State *L, int index, double period) {
+    Script *script = script_of(L);
+    if (!lua_isnoneornil(L, index)) {
+        return luaL_checknumber(L, index) * script->sample_rate;
+    }
+    return ceil((double)script->frame / period) * period;
+}
+
+// at(time, fn): call fn(t) on the sample at time (in seconds), or on the
+// next one if that is already past
+int l_at(lua_State *L) {
+    double origin = luaL_checknumber(L, 1) * script_of(L)->sample_rate;
+    if (origin < (double)script_of(L)->frame) {
+        origin = (double)script_of(L)->frame;
+    }
+    return schedule(L, 2, origin, 0.0, LUA_NOREF, 0);
+}
+
+// every(period, fn, start): call fn(t) every period seconds
+int l_every(lua_State *L) {
+    double period = luaL_checknumber(L, 1) * script_of(L)->sample_rate;
+    luaL_argcheck(L, period > 0.0, 1, "period must be positive");
+    return schedule(L, 2, periodic_origin(L, 3, period), period, LUA_NOREF, 0);
+}
+
+// pattern(steps, step, fn, start): step through steps every 'step' seconds,
+// looping, and call fn(t, value, index) on each step that isn't a rest
+int l_pattern(lua_State *L) {
+    int length;
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        length = (int)lua_objlen(L, 1);
+    } else {
+        luaL_checktype(L, 1, LUA_TTABLE);
+        length = (int)lua_objlen(L, 1);
+    }
+    luaL_argcheck(L, length > 0, 1, "pattern has no steps");
+    double period = luaL_checknumber(L, 2) * script_of(L)->sample_rate;
+    luaL_argcheck(L, period > 0.0, 2, "step must be positive");
+    double origin = periodic_origin(L, 4, period);
+    luaL_checktype(L, 3, LUA_TFUNCTION);
+    lua_pushvalue(L, 1);
+    int steps = luaL_ref(L, LUA_REGISTRYINDEX);
+    return schedule(L, 3, origin, period, steps, length);
+}
+
+// cancel(id): stop an event; true if it was still scheduled
+int l_cancel(lua_State *L) {
+    lua_pushboolean(L, script_cancel(script_of(L), (int)luaL_checkinteger(L, 1)));
+    return 1;
+}
+
+// Functions sharing the wavetable name -> handle table (upvalue 2)
+static const luaL_Reg chip_wavetable_lib[] = {
+    {"wt", l_wt},
+    {"wtb", l_wtb},
+    {"wtload", l_wtload},
+    {NULL, NULL}
+};
+
+// Userdata classes: metatable name and methods
+static const struct {
+    const char *name;
+    const luaL_Reg *methods;
+} chip_classes[] = {
+    {"chip.osc", osc_methods},
+    {"chip.biquad", biquad_methods},
+    {"chip.delay", delay_methods},
+    {"chip.comb", comb_methods},
+    {"chip.onepole", onepole_methods},
+    {"chip.adsr", adsr_methods},
+    {"chip.kr", kr_methods},
+};
+
+// Wavetable handle for the name (or handle) at index. Names are mapped to
+// handles through the table in upvalue 2, like sample paths.
+static int check_wavetable(lua_State *L, int index) {
+    if (lua_type(L, index) == LUA_TNUMBER) {
+        return (int)lua_tointeger(L, index);
+    }
+    const char *name = luaL_checkstring(L, index);
+    lua_pushvalue(L, index);
+    lua_rawget(L, lua_upvalueindex(2));
+    if (lua_isnumber(L, -1)) {
+        int handle = (int)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        return handle;
+    }
+    lua_pop(L, 1);
+
+    int handle = wavetable_find(name);
+    if (handle < 0) {
+        return luaL_error(L, "unknown wavetable '%s'", name);
+    }
+    lua_pushvalue(L, index);
+    lua_pushinteger(L, handle);
+    lua_rawset(L, lua_upvalueindex(2));
+    return handle;
+}
+
+// wt(name, t, freq, phase)
+int l_wt(lua_State *L) {
+    int handle = check_wavetable(L, 1);
+    double t = get_time(L, 2);
+    double freq = luaL_checknumber(L, 3);
+    double phase = luaL_optnumber(L, 4, 0.0);
+
+    lua_pushnumber(L, wavetable_value(handle, freq * t + phase, freq / script_of(L)->sample_rate));
+    return 1;
+}
+
+// wtb(buf, name, t0, dt, freq, phase, n)
+int l_wtb(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int handle = check_wavetable(L, 2);
+    double t0 = luaL_checknumber(L, 3);
+    double dt = luaL_checknumber(L, 4);
+    double freq = luaL_checknumber(L, 5);
+    double phase = luaL_optnumber(L, 6, 0.0);
+    int n = luaL_optint(L, 7, (int)lua_objlen(L, 1));
+    float chunk[BLOCK_CHUNK];
+
+    for (int start = 0; start < n; start += BLOCK_CHUNK) {
+        int len = n - start < BLOCK_CHUNK ? n - start : BLOCK_CHUNK;
+        wavetable_fill(handle, chunk, len, freq * (t0 + start * dt) + phase, freq * dt);
+        for (int i = 0; i < len; i++) {
+            lua_pushnumber(L, chunk[i]);
+            lua_rawseti(L, 1, start + i + 1);
+        }
+    }
+    return 0;
+}
+
+// wtload(name, path): load a single-cycle wave as wavetable name
+int l_wtload(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+    const char *path = luaL_checkstring(L, 2);
+    int handle = wavetable_load(name, path);
+    if (handle < 0) {
+        return luaL_error(L, "cannot load wavetable '%s' from %s", name, path);
+    }
+    lua_pushvalue(L, 1);
+    lua_pushinteger(L, handle);
+    lua_rawset(L, lua_upvalueindex(2));
+    lua_pushinteger(L, handle);
+    return 1;
+}
+
+// Handle for a wavetable name, for the FFI wtb
+static int wt_handle(lua_State *L) {
+    lua_pushinteger(L, check_wavetable(L, 1));
+    return 1;
+}
+
+static const char *const interp_names[] = {"none", "linear", "cubic", NULL};
+
+// Sample cache handle for the path (or handle) at index. Paths are mapped
+// to handles through the table in upvalue 1; Lua strings carry their hash,
+// so repeated lookups never hash the path again.
+static int check_sample(lua_State *L, int index) {
+    if (lua_type(L, index) == LUA_TNUMBER) {
+        return (int)lua_tointeger(L, index);
+    }
+    luaL_checkstring(L, index);
+    lua_pushvalue(L, index);
+    lua_rawget(L, lua_upvalueindex(1));
+    if (lua_isnumber(L, -1)) {
+        int handle = (int)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        return handle;
+    }
+    lua_pop(L, 1);
+
+    int handle = sample_cache_intern(lua_tostring(L, index));
+    lua_pushvalue(L, index);
+    lua_pushinteger(L, handle);
+    lua_rawset(L, lua_upvalueindex(1));
+    return handle;
+}
+
+// spl(path, t, interp)
 int l_spl(lua_State *L) {
-    const char *path = luaL_checkstring(L, 1);
+    int handle = check_sample(L, 1);
     double t = luaL_checknumber(L, 2);
-    (void)path;
-    (void)t;
-    
-    // For now, return 0 as we'll implement sample loading later
-    lua_pushnumber(L, 0.0);
+    int interp = lua_isnoneornil(L, 3) ? SAMPLE_INTERP_LINEAR
+                                       : luaL_checkoption(L, 3, NULL, interp_names);
+
+    lua_pushnumber(L, sample_cache_read(handle, t, interp));
+    return 1;
+}
+
+// preload(path)
+int l_preload(lua_State *L) {
+    int handle = check_sample(L, 1);
+    if (sample_cache_load(handle) != 0) {
+        return luaL_error(L, "cannot load sample %s", lua_tostring(L, 1));
+    }
+    lua_pushinteger(L, handle);
+    return 1;
+}
+
+// gain() or gain(level): the level this script's track is mixed at
+int l_gain(lua_State *L) {
+    Script *script = script_of(L);
+    if (lua_isnumber(L, 1)) {
+        script->gain = (float)lua_tonumber(L, 1);
+    }
+    lua_pushnumber(L, script->gain);
+    return 1;
+}
+
+// pure(): promise that main depends on t alone, with no state carried
+// from one call to the next, so future blocks can render out of order
+int l_pure(lua_State *L) {
+    script_of(L)->pure = 1;
+    return 0;
+}
+
+static void set_number(lua_State *L, const char *key, double value) {
+    lua_pushnumber(L, value);
+    lua_setfield(L, -2, key);
+}
+
+// stats(): engine counters, times in seconds and buffer levels (including
+// the latency target) in frames.
+// render_hist[i] counts blocks rendered in under render_hist_pct[i] percent
+// of their deadline; the last bucket counts the rest.
+int l_stats(lua_State *L) {
+    StatsSnapshot snap;
+    stats_snapshot(&snap);
+
+    lua_newtable(L);
+    set_number(L, "callbacks", (double)snap.callbacks);
+    set_number(L, "underruns", (double)snap.underruns);
+    set_number(L, "dropped_frames", (double)snap.dropped_frames);
+    set_number(L, "blocks", (double)snap.blocks);
+    set_number(L, "wakeups", (double)snap.wakeups);
+    set_number(L, "late_blocks", (double)snap.late_blocks);
+    set_number(L, "deadline", snap.deadline);
+    set_number(L, "render_max", snap.render_max);
+    set_number(L, "gc_time", snap.gc_time);
+    set_number(L, "gc_max", snap.gc_max);
+    set_number(L, "jitter", snap.jitter_mean);
+    set_number(L, "jitter_max", snap.jitter_max);
+    set_number(L, "ring_fill", snap.ring_fill);
+    set_number(L, "ring_min", snap.ring_min);
+    set_number(L, "ring_size", snap.ring_size);
+    set_number(L, "latency", snap.latency);
+    set_number(L, "lua_kb", lua_gc(L, LUA_GCCOUNT, 0));
+
+    lua_createtable(L, STATS_BUCKETS, 0);
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        lua_pushnumber(L, (double)snap.render_hist[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "render_hist");
+    lua_createtable(L, STATS_BUCKETS - 1, 0);
+    for (int i = 0; i < STATS_BUCKETS - 1; i++) {
+        lua_pushinteger(L, stats_bucket_pct[i]);
+        lua_rawseti(L, -2, i + 1);
+    }
+    lua_setfield(L, -2, "render_hist_pct");
     return 1;
 }
 
 // rnd() or rnd(max) or rnd(min, max)
 int l_rnd(lua_State *L) {
+    double r = rng_uniform(&script_of(L)->noise.rng);
     if (lua_gettop(L) == 0) {
         // rnd()
-        lua_pushnumber(L, (double)rand() / RAND_MAX);
+        lua_pushnumber(L, r);
     } else if (lua_gettop(L) == 1) {
         // rnd(max)
         double max = luaL_checknumber(L, 1);
-        lua_pushnumber(L, ((double)rand() / RAND_MAX) * max);
+        lua_pushnumber(L, r * max);
     } else {
         // rnd(min, max)
         double min = luaL_checknumber(L, 1);
         double max = luaL_checknumber(L, 2);
-        lua_pushnumber(L, min + ((double)rand() / RAND_MAX) * (max - min));
+        lua_pushnumber(L, min + r * (max - min));
     }
     return 1;
 }
@@ -111,21 +940,70 @@ int l_rndf(lua_State *L) {
     return l_rnd(L); // Same as rnd for now
 }
 
-// rndi(max) or rndi(min, max)
+// rndi(max) or rndi(min, max): integer in [min, max] (min defaults to 0),
+// in either order
 int l_rndi(lua_State *L) {
+    lua_Integer lo = 0, hi;
     if (lua_gettop(L) == 1) {
         // rndi(max)
-        int max = luaL_checkinteger(L, 1);
-        lua_pushinteger(L, rand() % (max + 1));
+        hi = luaL_checkinteger(L, 1);
     } else {
         // rndi(min, max)
-        int min = luaL_checkinteger(L, 1);
-        int max = luaL_checkinteger(L, 2);
-        lua_pushinteger(L, min + (rand() % (max - min + 1)));
+        lo = luaL_checkinteger(L, 1);
+        hi = luaL_checkinteger(L, 2);
     }
+    if (hi < lo) {
+        lua_Integer swap = lo;
+        lo = hi;
+        hi = swap;
+    }
+    Rng *rng = &script_of(L)->noise.rng;
+    uint64_t range = (uint64_t)hi - (uint64_t)lo + 1;
+    // range wraps to 0 only when it spans every 64-bit value
+    uint64_t r = range ? rng_below(rng, range) : rng_next(rng);
+    lua_pushinteger(L, (lua_Integer)((uint64_t)lo + r));
     return 1;
 }
 
+// seed(n): restart rnd* and the noise fills from n, so renders repeat
+int l_seed(lua_State *L) {
+    noise_seed(&script_of(L)->noise, (uint64_t)(int64_t)luaL_checknumber(L, 1));
+    return 0;
+}
+
+// Fill buf[1..n] (n defaults to #buf) with one of the noise generators
+static int fill_noise(lua_State *L, void (*fill)(Noise *, float *, int)) {
+    Noise *noise = &script_of(L)->noise;
+    luaL_checktype(L, 1, LUA_TTABLE);
+    int n = luaL_optint(L, 2, (int)lua_objlen(L, 1));
+    float chunk[BLOCK_CHUNK];
+
+    for (int start = 0; start < n; start += BLOCK_CHUNK) {
+        int len = n - start < BLOCK_CHUNK ? n - start : BLOCK_CHUNK;
+        fill(noise, chunk, len);
+        for (int i = 0; i < len; i++) {
+            lua_pushnumber(L, chunk[i]);
+            lua_rawseti(L, 1, start + i + 1);
+        }
+    }
+    return 0;
+}
+
+// whiteb(buf, n)
+int l_whiteb(lua_State *L) {
+    return fill_noise(L, noise_white);
+}
+
+// pinkb(buf, n)
+int l_pinkb(lua_State *L) {
+    return fill_noise(L, noise_pink);
+}
+
+// brownb(buf, n)
+int l_brownb(lua_State *L) {
+    return fill_noise(L, noise_brown);
+}
+
 // print(message)
 int l_print(lua_State *L) {
     const char *message = luaL_checkstring(L, 1);
@@ -133,24 +1011,169 @@ int l_print(lua_State *L) {
     return 0;
 }
 
+// record(path): record the output of every track to path, replacing
+// the current recording if any; false when not playing live
+int l_record(lua_State *L) {
+    lua_pushboolean(L, record_start(luaL_checkstring(L, 1)) == 0);
+    return 1;
+}
+
+// stoprecord(): finish the current recording
+int l_stoprecord(lua_State *L) {
+    (void)L;
+    record_stop();
+    return 0;
+}
+
 // Register all functions in the Lua state
 static const luaL_Reg chip_lib[] = {
     {"sin", l_sin},
     {"saw", l_saw},
     {"sq", l_sq},
     {"tri", l_tri},
-    {"spl", l_spl},
+    {"sinb", l_sinb},
+    {"sawb", l_sawb},
+    {"sqb", l_sqb},
+    {"trib", l_trib},
+    {"osc", l_osc},
+    {"biquad", l_biquad},
+    {"delay", l_delay},
+    {"comb", l_comb},
+    {"allpass", l_allpass},
+    {"onepole", l_onepole},
+    {"adsr", l_adsr},
+    {"kr", l_kr},
+    {"expr", l_expr},
+    {"at", l_at},
+    {"every", l_every},
+    {"pattern", l_pattern},
+    {"cancel", l_cancel},
+    {"gain", l_gain},
+    {"pure", l_pure},
+    {"stats", l_stats},
     {"rnd", l_rnd},
     {"rndf", l_rndf},
     {"rndi", l_rndi},
+    {"seed", l_seed},
+    {"whiteb", l_whiteb},
+    {"pinkb", l_pinkb},
+    {"brownb", l_brownb},
+    {"record", l_record},
+    {"stoprecord", l_stoprecord},
     {"print", l_print},
     {NULL, NULL}
 };
 
-// Open the library
-int luaopen_audio(lua_State *L) {
-    printf("luaopen_audio: Starting...\n");
-    
+// Functions sharing the path -> sample handle table
+static const luaL_Reg chip_sample_lib[] = {
+    {"spl", l_spl},
+    {"preload", l_preload},
+    {NULL, NULL}
+};
+
+// LuaJIT only: block builtins, wtb, noise fills, osc:fill and the DSP
+// units' processBlock given an FFI float* call the C kernels through
+// ffi.C, and the returned dispatcher hands main(t0, dt, n, out) a float*
+// view of the output buffer, offset so out[1] is the first sample.
+static const char *ffi_setup =
+    "local ffi = require('ffi')\n"
+    "ffi.cdef[[\n"
+    "void osc_block_sin(float *out, int n, double phase, double inc);\n"
+    "void osc_block_saw(float *out, int n, double phase, double inc);\n"
+    "void osc_block_sq(float *out, int n, double phase, double inc);\n"
+    "void osc_block_tri(float *out, int n, double phase, double inc);\n"
+    "]]\n"
+    "local C, cast = ffi.C, ffi.cast\n"
+    "local function wrap(name, kernel, scale)\n"
+    "    local fill = chip[name]\n"
+    "    chip[name] = function(buf, t0, dt, freq, phase, n)\n"
+    "        if type(buf) ~= 'cdata' then\n"
+    "            return fill(buf, t0, dt, freq, phase, n)\n"
+    "        end\n"
+    "        kernel(buf + 1, n, freq * t0 + (phase or 0) * scale, freq * dt)\n"
+    "    end\n"
+    "end\n"
+    "wrap('sinb', C.osc_block_sin, 1 / (2 * math.pi))\n"
+    "wrap('sawb', C.osc_block_saw, 1)\n"
+    "wrap('sqb', C.osc_block_sq, 1)\n"
+    "wrap('trib', C.osc_block_tri, 1)\n"
+    "ffi.cdef('void osc_fill(void *osc, float *out, int n);')\n"
+    "local methods = debug.getregistry()['chip.osc'].__index\n"
+    "local fill = methods.fill\n"
+    "methods.fill = function(osc, buf, n)\n"
+    "    if type(buf) ~= 'cdata' then\n"
+    "        return fill(osc, buf, n)\n"
+    "    end\n"
+    "    C.osc_fill(osc, buf + 1, n)\n"
+    "end\n"
+    "ffi.cdef[[\n"
+    "void noise_white(void *noise, float *out, int n);\n"
+    "void noise_pink(void *noise, float *out, int n);\n"
+    "void noise_brown(void *noise, float *out, int n);\n"
+    "]]\n"
+    "local noise = debug.getregistry()['chip.noise']\n"
+    "local function wrap_noise(name, kernel)\n"
+    "    local fill = chip[name]\n"
+    "    chip[name] = function(buf, n)\n"
+    "        if type(buf) ~= 'cdata' then\n"
+    "            return fill(buf, n)\n"
+    "        end\n"
+    "        kernel(noise, buf + 1, n)\n"
+    "    end\n"
+    "end\n"
+    "wrap_noise('whiteb', C.noise_white)\n"
+    "wrap_noise('pinkb', C.noise_pink)\n"
+    "wrap_noise('brownb', C.noise_brown)\n"
+    "ffi.cdef('void wavetable_fill(int handle, float *out, int n, double phase, double inc);')\n"
+    "local wt_handle, wtb = debug.getregistry()['chip.wt_handle'], chip.wtb\n"
+    "chip.wtb = function(buf, name, t0, dt, freq, phase, n)\n"
+    "    if type(buf) ~= 'cdata' then\n"
+    "        return wtb(buf, name, t0, dt, freq, phase, n)\n"
+    "    end\n"
+    "    C.wavetable_fill(wt_handle(name), buf + 1, n, freq * t0 + (phase or 0), freq * dt)\n"
+    "end\n"
+    "ffi.cdef[[\n"
+    "void biquad_block(void *unit, float *buf, int n);\n"
+    "void delay_block(void *unit, float *buf, int n);\n"
+    "void comb_block(void *unit, float *buf, int n);\n"
+    "void onepole_block(void *unit, float *buf, int n);\n"
+    "void adsr_block(void *unit, float *buf, int n);\n"
+    "]]\n"
+    "for name, kernel in pairs({biquad = C.biquad_block, delay = C.delay_block,\n"
+    "                           comb = C.comb_block, onepole = C.onepole_block,\n"
+    "                           adsr = C.adsr_block}) do\n"
+    "    local methods = debug.getregistry()['chip.' .. name].__index\n"
+    "    local block = methods.processBlock\n"
+    "    methods.processBlock = function(unit, buf, n)\n"
+    "        if type(buf) ~= 'cdata' then\n"
+    "            return block(unit, buf, n)\n"
+    "        end\n"
+    "        kernel(unit, buf + 1, n)\n"
+    "    end\n"
+    "end\n"
+    "return function(main, t0, dt, n, out)\n"
+    "    return main(t0, dt, n, cast('float *', out) - 1)\n"
+    "end\n";
+
+// Install the FFI fast path when running under LuaJIT
+static void open_ffi(lua_State *L) {
+    lua_getglobal(L, "jit");
+    int is_luajit = lua_istable(L, -1);
+    lua_pop(L, 1);
+    if (!is_luajit) {
+        return;
+    }
+
+    if (luaL_loadstring(L, ffi_setup) != 0 || lua_pcall(L, 0, 1, 0) != 0) {
+        fprintf(stderr, "Warning: LuaJIT FFI fast path disabled: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return;
+    }
+    lua_setfield(L, LUA_REGISTRYINDEX, "chip.ffi_block");
+}
+
+// Open the library for script
+int luaopen_audio(lua_State *L, Script *script) {
     // Get or create the chip table
     lua_getglobal(L, "chip");
     if (!lua_istable(L, -1)) {
@@ -160,20 +1183,70 @@ int luaopen_audio(lua_State *L) {
         lua_setglobal(L, "chip");  // Set as global 'chip'
     }
     
-    // Register all functions into the chip table
+    // Register all functions into the chip table, as closures over script
     const luaL_Reg *lib;
     for (lib = chip_lib; lib->func; lib++) {
         lua_pushstring(L, lib->name);
-        lua_pushcfunction(L, lib->func);
+        lua_pushlightuserdata(L, script);
+        lua_pushcclosure(L, lib->func, 1);
         lua_settable(L, -3);
-        printf("luaopen_audio: Registered function %s\n", lib->name);
     }
-    
-    printf("luaopen_audio: Storing audio state...\n");
-    // Store audio state in the registry
-    lua_pushlightuserdata(L, &audio_state);
-    lua_setfield(L, LUA_REGISTRYINDEX, "chip.audio_state");
-    
-    printf("luaopen_audio: Done\n");
+
+    lua_newtable(L);  // path -> sample handle
+    for (lib = chip_sample_lib; lib->func; lib++) {
+        lua_pushstring(L, lib->name);
+        lua_pushvalue(L, -2);
+        lua_pushcclosure(L, lib->func, 1);
+        lua_settable(L, -4);
+    }
+    lua_pop(L, 1);
+
+    lua_newtable(L);  // name -> wavetable handle
+    for (lib = chip_wavetable_lib; lib->func; lib++) {
+        lua_pushstring(L, lib->name);
+        lua_pushlightuserdata(L, script);
+        lua_pushvalue(L, -3);
+        lua_pushcclosure(L, lib->func, 2);
+        lua_settable(L, -4);
+    }
+    lua_pushlightuserdata(L, script);
+    lua_pushvalue(L, -2);
+    lua_pushcclosure(L, wt_handle, 2);
+    lua_setfield(L, LUA_REGISTRYINDEX, "chip.wt_handle");
+    lua_pop(L, 1);
+
+    // Output layout, for scripts that return one value per channel
+    lua_pushinteger(L, script->channels);
+    lua_setfield(L, -2, "channels");
+
+    // Oscillator and DSP objects
+    for (size_t i = 0; i < sizeof(chip_classes) / sizeof(chip_classes[0]); i++) {
+        luaL_newmetatable(L, chip_classes[i].name);
+        lua_newtable(L);
+        for (lib = chip_classes[i].methods; lib->func; lib++) {
+            lua_pushlightuserdata(L, script);
+            lua_pushcclosure(L, lib->func, 1);
+            lua_setfield(L, -2, lib->name);
+        }
+        lua_setfield(L, -2, "__index");
+        lua_pop(L, 1);
+    }
+
+    // Bytebeat expressions own their compiled code
+    luaL_newmetatable(L, "chip.expr");
+    lua_pushcfunction(L, expr_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pop(L, 1);
+
+    // Noise state of the script, for the FFI noise fills
+    lua_pushlightuserdata(L, &script->noise);
+    lua_setfield(L, LUA_REGISTRYINDEX, "chip.noise");
+
+    open_ffi(L);
+
+    // Store the script in the registry
+    lua_pushlightuserdata(L, script);
+    lua_setfield(L, LUA_REGISTRYINDEX, "chip.script");
+
     return 1;  // Return the chip table
 }
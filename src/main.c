@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
@@ -12,6 +13,13 @@
 #endif
 #endif
 #include "audio.h"
+#include "render.h"
+#include "sample_cache.h"
+#include "wavetable.h"
+#include "reload.h"
+#include "stats.h"
+#include "rt.h"
+#include "record.h"
 
 // Windows-specific includes
 #ifdef _WIN32
@@ -30,6 +38,7 @@ static volatile bool running = true;
 static BOOL WINAPI console_handler(DWORD signal) {
     if (signal == CTRL_C_EVENT) {
         running = false;
+        audio_interrupt();
         return TRUE;
     }
     return FALSE;
@@ -38,12 +47,129 @@ static BOOL WINAPI console_handler(DWORD signal) {
 void handle_signal(int sig) {
     (void)sig;
     running = false;
+    audio_interrupt();
 }
 #endif
 
+static void close_tracks(void) {
+    for (int i = 0; i < audio_state.track_count; i++) {
+        track_close(&audio_state.tracks[i]);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] <script.lua|song.bb>...\n", prog);
+    fprintf(stderr, "Each script plays as its own track, rendered on its own thread.\n");
+    fprintf(stderr, "A .bb file holds a bytebeat expression (see chip.expr).\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --render <file>        Render to an audio file instead of playing\n");
+    fprintf(stderr, "  --record <file>        Record what is played to an audio file (.wav, .flac, ...)\n");
+    fprintf(stderr, "  --duration <seconds>   Length of an offline render (default 10)\n");
+    fprintf(stderr, "  --sample-cache <MB>    Memory cap for decoded samples (default 64)\n");
+    fprintf(stderr, "  --lua-mem <MB>         Memory cap for each script's Lua state (default none)\n");
+    fprintf(stderr, "  --rate <Hz>            Sample rate (default 44100)\n");
+    fprintf(stderr, "  --render-rate <Hz>     Rate the scripts run at, resampled to --rate (default the same)\n");
+    fprintf(stderr, "  --block <frames>       Frames rendered per block (default 512)\n");
+    fprintf(stderr, "  --ring <blocks>        Blocks queued for the device (default 8)\n");
+    fprintf(stderr, "  --adaptive             Tune the queued blocks at runtime from underruns\n");
+    fprintf(stderr, "  --channels <n>         Output channels (default 1)\n");
+    fprintf(stderr, "  --crossfade <ms>       Crossfade between old and new script on reload (default 10, 0 = off)\n");
+    fprintf(stderr, "  --realtime             Run the audio threads with SCHED_FIFO priority and lock memory\n");
+    fprintf(stderr, "  --cpus <list>          Pin the mixer and then each track to these CPUs, e.g. 2,3\n");
+    fprintf(stderr, "  --watchdog <ms>        Abort script blocks running longer than this (default 4 blocks,\n");
+    fprintf(stderr, "                         none when rendering; 0 = off). Pure scripts' workers\n");
+    fprintf(stderr, "                         get it times the number of workers\n");
+    fprintf(stderr, "  --pure                 Render every script as pure (see chip.pure): future blocks\n");
+    fprintf(stderr, "                         render in parallel on worker threads\n");
+    fprintf(stderr, "  --workers <n>          Worker threads per pure track (default one per CPU but one)\n");
+    fprintf(stderr, "  --stats <file>         Append engine stats as JSON lines every second (- for stderr)\n");
+}
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <script.lua>\n", argv[0]);
+    const char *script_paths[TRACK_MAX];
+    int script_count = 0;
+    const char *render_path = NULL;
+    const char *stats_path = NULL;
+    const char *record_path = NULL;
+    double duration = 10.0;
+    int sample_cache_mb = 64;
+    int lua_mem_mb = 0;
+    int crossfade_ms = -1;
+    int channels = 0;
+    int sample_rate = 0;
+    int render_rate = 0;
+    int block_size = 0;
+    int ring_blocks = 0;
+    int adaptive = 0;
+    int realtime = 0;
+    double watchdog_ms = -1.0;
+    int pure = 0;
+    int workers = 0;
+    int cpus[TRACK_MAX + 1];
+    int cpu_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--render") == 0 && i + 1 < argc) {
+            render_path = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            duration = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--sample-cache") == 0 && i + 1 < argc) {
+            sample_cache_mb = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--lua-mem") == 0 && i + 1 < argc) {
+            lua_mem_mb = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            stats_path = argv[++i];
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            sample_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--render-rate") == 0 && i + 1 < argc) {
+            render_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--block") == 0 && i + 1 < argc) {
+            block_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ring") == 0 && i + 1 < argc) {
+            ring_blocks = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--adaptive") == 0) {
+            adaptive = 1;
+        } else if (strcmp(argv[i], "--realtime") == 0) {
+            realtime = RT_PRIORITY;
+        } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+            cpu_count = rt_parse_cpus(argv[++i], cpus, TRACK_MAX + 1);
+            if (cpu_count <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--watchdog") == 0 && i + 1 < argc) {
+            watchdog_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--pure") == 0) {
+            pure = 1;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+            if (workers < 1 || workers > PURE_MAX_WORKERS) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc) {
+            channels = atoi(argv[++i]);
+            if (channels < 1) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--crossfade") == 0 && i + 1 < argc) {
+            crossfade_ms = atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else if (script_count == TRACK_MAX) {
+            fprintf(stderr, "Too many scripts (at most %d)\n", TRACK_MAX);
+            return 1;
+        } else {
+            script_paths[script_count++] = argv[i];
+        }
+    }
+    if (script_count == 0 || duration <= 0.0 || sample_cache_mb <= 0 || lua_mem_mb < 0 ||
+        sample_rate < 0 || render_rate < 0 || block_size < 0 || ring_blocks < 0) {
+        usage(argv[0]);
         return 1;
     }
 
@@ -58,62 +184,122 @@ int main(int argc, char *argv[]) {
     signal(SIGTERM, handle_signal);
 #endif
 
-    // Initialize Lua state
-    lua_State *L = luaL_newstate();
-    if (!L) {
-        fprintf(stderr, "Failed to initialize Lua\n");
+    // Render settings, shared by live and offline modes
+    audio_configure(sample_rate, block_size, ring_blocks);
+    audio_state.adaptive = adaptive;
+    audio_state.realtime = realtime;
+    memcpy(audio_state.cpus, cpus, (size_t)cpu_count * sizeof(int));
+    audio_state.cpu_count = cpu_count;
+    if (channels > 0) {
+        audio_state.channels = channels;
+    }
+    if (crossfade_ms >= 0) {
+        audio_state.crossfade = audio_state.sample_rate * crossfade_ms / 1000;
+    }
+    if (render_rate == 0) {
+        render_rate = audio_state.sample_rate;
+    } else if (render_rate > audio_state.sample_rate) {
+        fprintf(stderr, "--render-rate can't be above the sample rate (%d)\n", audio_state.sample_rate);
         return 1;
     }
-    luaL_openlibs(L);
 
-    audio_state.L = L;
+    // Initialize audio; offline rendering needs no device
+    if (!render_path) {
+        printf("Initializing audio...\n");
+        if (audio_init() != 0) {
+            fprintf(stderr, "Failed to initialize audio\n");
+            return 1;
+        }
+    }
 
-    // Initialize audio
-    printf("Initializing audio...\n");
-    if (audio_init() != 0) {
-        fprintf(stderr, "Failed to initialize audio\n");
-        lua_close(L);
+    // Decoded samples load in the background while playing live, and
+    // synchronously when rendering so renders are reproducible
+    sample_cache_init((size_t)sample_cache_mb * 1024 * 1024, render_path == NULL);
+    if (wavetable_init() != 0) {
+        audio_cleanup();
+        sample_cache_shutdown();
+        wavetable_shutdown();
         return 1;
     }
 
-    // Create and register the chip module
-    printf("1. Setting up audio module...\n");
-    lua_newtable(L);  // Create the chip table
-    lua_setglobal(L, "chip");  // Set as global 'chip'
-    
-    // Register audio functions
-    lua_getglobal(L, "chip");
-    luaopen_audio(L);  // This will populate the 'chip' table with functions
-    lua_pop(L, 1);  // Pop the chip table
-    
-    printf("2. Loading script: %s\n", argv[1]);
-    if (luaL_dofile(L, argv[1]) != 0) {
-        fprintf(stderr, "Error loading script: %s\n", lua_tostring(L, -1));
-        lua_close(L);
+    script_set_memory_limit((size_t)lua_mem_mb * 1024 * 1024);
+
+    // The recorder's writer thread waits for chip.record or --record. It
+    // starts before the scripts load, so chip.record works at their top.
+    if (!render_path && record_init(audio_state.sample_rate, audio_state.channels) != 0) {
         audio_cleanup();
+        sample_cache_shutdown();
+        wavetable_shutdown();
         return 1;
     }
-    
-    // The script should return a function, which we'll store as 'main'
-    if (!lua_isfunction(L, -1)) {
-        fprintf(stderr, "Script must return a function\n");
-        lua_close(L);
+
+    // Give each script a track with its own Lua state and the chip
+    // module; the script returns its generator, which is stored as 'main'
+    for (int i = 0; i < script_count; i++) {
+        printf("Loading script: %s\n", script_paths[i]);
+        if (track_open(&audio_state.tracks[i], script_paths[i], audio_state.sample_rate,
+                       render_rate, audio_state.buffer_size, audio_state.channels,
+                       audio_state.crossfade) != 0) {
+            audio_cleanup();
+            record_shutdown();
+            close_tracks();
+            sample_cache_shutdown();
+            wavetable_shutdown();
+            return 1;
+        }
+        // Renders are reproducible unless a watchdog is asked for
+        if (watchdog_ms >= 0.0 || render_path) {
+            audio_state.tracks[i].watchdog = watchdog_ms > 0.0 ? watchdog_ms / 1000.0 : 0.0;
+        }
+        audio_state.tracks[i].pure = pure;
+        if (workers > 0) {
+            audio_state.tracks[i].workers = workers;
+        }
+        audio_state.track_count++;
+    }
+    printf("Script loaded successfully\n");
+
+    if (render_path) {
+        if (record_path) {
+            fprintf(stderr, "Warning: --record is ignored when rendering\n");
+        }
+        int result = render_offline(&audio_state, render_path, duration);
+        close_tracks();
+        sample_cache_shutdown();
+        wavetable_shutdown();
+        return result;
+    }
+
+    if (stats_path && stats_open(stats_path) != 0) {
         audio_cleanup();
+        record_shutdown();
+        close_tracks();
+        sample_cache_shutdown();
+        wavetable_shutdown();
         return 1;
     }
-    
-    // Store the returned function as 'main' in the global table
-    lua_setglobal(L, "main");
-    printf("3. Script loaded successfully\n");
 
-    // Save script path for live reload
-    snprintf(audio_state.script_path, sizeof(audio_state.script_path), "%s", argv[1]);
+    if (record_path) {
+        record_start(record_path);
+    }
+
+    // Scripts and buffers are loaded: keep them in RAM from now on
+    if (realtime) {
+        rt_lock_memory();
+    }
 
-    // Start producer thread to pre-render audio into the ring buffer
-    if (audio_start_producer() != 0) {
+    // Start the tracks' render threads and the producer that mixes them
+    // into the ring buffer, and the watcher that reloads changed scripts
+    if (audio_start_producer() != 0 ||
+        reload_start(audio_state.tracks, audio_state.track_count) != 0) {
         fprintf(stderr, "Failed to start audio producer\n");
         audio_cleanup();
-        lua_close(L);
+        record_shutdown();
+        reload_stop();
+        close_tracks();
+        sample_cache_shutdown();
+        wavetable_shutdown();
+        stats_close();
         return 1;
     }
 
@@ -135,9 +321,15 @@ int main(int argc, char *argv[]) {
 #endif
     }
 
-    // Cleanup
+    // Cleanup: the producer and tracks stop first, then the recorder
+    // finishes its file and the watcher stops
     audio_cleanup();
-    lua_close(L);
+    record_shutdown();
+    reload_stop();
+    close_tracks();
+    sample_cache_shutdown();
+    wavetable_shutdown();
+    stats_close();
 
     return 0;
 }
@@ -0,0 +1,98 @@
+#include <string.h>
+#include "noise.h"
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+void rng_seed(Rng *rng, uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        // splitmix64, so nearby seeds give unrelated states
+        uint64_t z = (seed += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        rng->s[i] = z ^ (z >> 31);
+    }
+}
+
+uint64_t rng_next(Rng *rng) {
+    uint64_t *s = rng->s;
+    const uint64_t result = rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+double rng_uniform(Rng *rng) {
+    return (double)(rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+uint64_t rng_below(Rng *rng, uint64_t n) {
+    // Reject the top partial copy of [0, n) so every value is equally likely
+    uint64_t limit = UINT64_MAX - UINT64_MAX % n;
+    uint64_t x;
+    do {
+        x = rng_next(rng);
+    } while (x >= limit);
+    return x % n;
+}
+
+void noise_seed(Noise *noise, uint64_t seed) {
+    rng_seed(&noise->rng, seed);
+    memset(noise->pink, 0, sizeof(noise->pink));
+    noise->brown = 0.0f;
+}
+
+// Two white samples in [-1, 1) from one 64-bit draw, 24 bits each
+static inline void white_pair(Rng *rng, float *a, float *b) {
+    uint64_t x = rng_next(rng);
+    *a = (float)(int32_t)(x >> 40 << 8) * 0x1.0p-31f;
+    *b = (float)(int32_t)((x >> 16) << 8) * 0x1.0p-31f;
+}
+
+void noise_white(Noise *noise, float *out, int n) {
+    int i = 0;
+    for (; i + 1 < n; i += 2) {
+        white_pair(&noise->rng, &out[i], &out[i + 1]);
+    }
+    if (i < n) {
+        float spare;
+        white_pair(&noise->rng, &out[i], &spare);
+    }
+}
+
+// Paul Kellet's pink filter: white noise through a bank of one-pole
+// filters, within 0.05 dB of -3 dB/octave above 9 Hz
+void noise_pink(Noise *noise, float *out, int n) {
+    float *b = noise->pink;
+    noise_white(noise, out, n);
+    for (int i = 0; i < n; i++) {
+        float w = out[i];
+        b[0] = 0.99886f * b[0] + w * 0.0555179f;
+        b[1] = 0.99332f * b[1] + w * 0.0750759f;
+        b[2] = 0.96900f * b[2] + w * 0.1538520f;
+        b[3] = 0.86650f * b[3] + w * 0.3104856f;
+        b[4] = 0.55000f * b[4] + w * 0.5329522f;
+        b[5] = -0.7616f * b[5] - w * 0.0168980f;
+        float p = b[0] + b[1] + b[2] + b[3] + b[4] + b[5] + b[6] + w * 0.5362f;
+        b[6] = w * 0.115926f;
+        out[i] = p * 0.11f;
+    }
+}
+
+// Leaky integrator of white noise
+void noise_brown(Noise *noise, float *out, int n) {
+    float y = noise->brown;
+    noise_white(noise, out, n);
+    for (int i = 0; i < n; i++) {
+        y = (y + 0.02f * out[i]) / 1.02f;
+        out[i] = y * 3.5f;
+    }
+    noise->brown = y;
+}
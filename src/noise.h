@@ -0,0 +1,40 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <stdint.h>
+
+// xoshiro256** pseudo-random generator: fast, 256 bits of state, good
+// low bits, and reproducible from a 64-bit seed
+typedef struct Rng {
+    uint64_t s[4];
+} Rng;
+
+// Expand seed into the generator state (with splitmix64)
+void rng_seed(Rng *rng, uint64_t seed);
+
+uint64_t rng_next(Rng *rng);
+
+// Uniform double in [0, 1), from the top 53 bits
+double rng_uniform(Rng *rng);
+
+// Uniform integer in [0, n) without modulo bias; n > 0
+uint64_t rng_below(Rng *rng, uint64_t n);
+
+// Noise source: a generator plus the filter state of pink and brown noise,
+// so consecutive fills continue the same signal
+typedef struct Noise {
+    Rng rng;
+    float pink[7];
+    float brown;
+} Noise;
+
+// Seed the generator and clear the filters
+void noise_seed(Noise *noise, uint64_t seed);
+
+// Fill out[0..n-1] with white, pink (-3 dB/octave) or brown (-6 dB/octave)
+// noise. White is in [-1, 1); pink and brown are scaled to roughly that.
+void noise_white(Noise *noise, float *out, int n);
+void noise_pink(Noise *noise, float *out, int n);
+void noise_brown(Noise *noise, float *out, int n);
+
+#endif // NOISE_H
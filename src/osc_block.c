@@ -0,0 +1,180 @@
+#include <math.h>
+#include "osc_block.h"
+
+// sin(pi * a) ~= a * (S1 + a^2 * (S3 + a^2 * (S5 + a^2 * S7))) on [0, 0.5]
+#define S1 3.1415820238f
+#define S3 -5.1671428406f
+#define S5 2.5418993450f
+#define S7 -0.5546368751f
+
+// Vector primitives. Every kernel below is written once against these.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define OSC_SIMD "avx"
+#define VW 8
+typedef __m256 vf;
+#define vset(x) _mm256_set1_ps(x)
+#define vadd _mm256_add_ps
+#define vsub _mm256_sub_ps
+#define vmul _mm256_mul_ps
+#define vmin _mm256_min_ps
+#define vfloor _mm256_floor_ps
+#define vramp() _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f)
+#define vstore _mm256_storeu_ps
+#define vsign() _mm256_set1_ps(-0.0f)
+#define vabs(a) _mm256_andnot_ps(vsign(), a)
+#define vcopysign(a, b) _mm256_or_ps(vabs(a), _mm256_and_ps(vsign(), b))
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define OSC_SIMD "sse2"
+#define VW 4
+typedef __m128 vf;
+#define vset(x) _mm_set1_ps(x)
+#define vadd _mm_add_ps
+#define vsub _mm_sub_ps
+#define vmul _mm_mul_ps
+#define vmin _mm_min_ps
+#define vramp() _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f)
+#define vstore _mm_storeu_ps
+#define vsign() _mm_set1_ps(-0.0f)
+#define vabs(a) _mm_andnot_ps(vsign(), a)
+#define vcopysign(a, b) _mm_or_ps(vabs(a), _mm_and_ps(vsign(), b))
+// SSE2 has no floor: truncate, then step down where that rounded up
+static inline vf vfloor(vf x) {
+    vf t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define OSC_SIMD "neon"
+#define VW 4
+typedef float32x4_t vf;
+#define vset(x) vdupq_n_f32(x)
+#define vadd vaddq_f32
+#define vsub vsubq_f32
+#define vmul vmulq_f32
+#define vmin vminq_f32
+#define vstore vst1q_f32
+#define vabs vabsq_f32
+static inline vf vramp(void) {
+    static const float ramp[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+    return vld1q_f32(ramp);
+}
+static inline vf vfloor(vf x) {
+    vf t = vcvtq_f32_s32(vcvtq_s32_f32(x));
+    uint32x4_t up = vcgtq_f32(t, x);
+    return vsubq_f32(t, vreinterpretq_f32_u32(vandq_u32(up, vreinterpretq_u32_f32(vdupq_n_f32(1.0f)))));
+}
+static inline vf vcopysign(vf a, vf b) {
+    return vbslq_f32(vdupq_n_u32(0x80000000u), b, a);
+}
+
+#else
+#define OSC_SIMD "scalar"
+#define VW 1
+typedef float vf;
+#define vset(x) (x)
+#define vadd(a, b) ((a) + (b))
+#define vsub(a, b) ((a) - (b))
+#define vmul(a, b) ((a) * (b))
+#define vmin(a, b) fminf(a, b)
+#define vfloor floorf
+#define vramp() 0.0f
+#define vstore(p, a) (*(p) = (a))
+#define vabs fabsf
+#define vcopysign copysignf
+#endif
+
+// x - floor(x), without a libm call
+static inline double frac(double x) {
+    double t = (double)(long long)x;
+    return x - (t > x ? t - 1.0 : t);
+}
+
+// Waveforms of a phase p in [0, 1), matching the chip.* scalar functions
+
+static inline vf wave_sin(vf p) {
+    // sin(2 pi p) = -sin(pi z) with z = 2p - 1 in [-1, 1); fold |z| into
+    // [0, 0.5] using sin(pi a) = sin(pi (1 - a))
+    vf z = vsub(vadd(p, p), vset(1.0f));
+    vf a = vabs(z);
+    a = vmin(a, vsub(vset(1.0f), a));
+    vf a2 = vmul(a, a);
+    vf s = vmul(a, vadd(vset(S1), vmul(a2, vadd(vset(S3), vmul(a2, vadd(vset(S5), vmul(a2, vset(S7))))))));
+    return vcopysign(s, vsub(vset(0.0f), z));
+}
+
+static inline vf wave_saw(vf p) {
+    // 2 * (p - floor(p + 0.5))
+    vf x = vsub(p, vfloor(vadd(p, vset(0.5f))));
+    return vadd(x, x);
+}
+
+static inline vf wave_sq(vf p) {
+    // 1 for the first half cycle, -1 for the second
+    vf h = vfloor(vadd(p, p));
+    return vsub(vset(1.0f), vadd(h, h));
+}
+
+static inline vf wave_tri(vf p) {
+    // 1 - 4 * |y - round(y)| with y = p - 0.25
+    vf y = vsub(p, vset(0.25f));
+    vf d = vabs(vsub(y, vfloor(vadd(y, vset(0.5f)))));
+    return vsub(vset(1.0f), vmul(vset(4.0f), d));
+}
+
+// Fill out with wave(frac(phase + i * inc)), one vector at a time. The
+// phase of each vector's first lane is reduced in double precision, so
+// float lanes only ever hold a phase within a few cycles of zero.
+#define OSC_KERNEL(name, wave)                                              \
+void name(float *out, int n, double phase, double inc) {                   \
+    const vf ramp = vmul(vramp(), vset((float)inc));                        \
+    int i = 0;                                                              \
+    for (; i + VW <= n; i += VW) {                                          \
+        double base = phase + i * inc;                                      \
+        vf p = vadd(vset((float)frac(base)), ramp);                         \
+        vstore(&out[i], wave(vsub(p, vfloor(p))));                          \
+    }                                                                       \
+    for (; i < n; i++) {                                                    \
+        float lane[VW];                                                     \
+        vstore(lane, wave(vset((float)frac(phase + i * inc))));             \
+        out[i] = lane[0];                                                   \
+    }                                                                       \
+}
+
+OSC_KERNEL(osc_block_sin, wave_sin)
+OSC_KERNEL(osc_block_saw, wave_saw)
+OSC_KERNEL(osc_block_sq, wave_sq)
+OSC_KERNEL(osc_block_tri, wave_tri)
+
+static void (*const osc_kernels[])(float *, int, double, double) = {
+    osc_block_sin, osc_block_saw, osc_block_sq, osc_block_tri
+};
+
+void osc_init(Osc *osc, int kind, double freq, double sample_rate) {
+    osc->kind = kind;
+    osc->phase = 0.0;
+    osc_set_freq(osc, freq, sample_rate);
+}
+
+void osc_set_freq(Osc *osc, double freq, double sample_rate) {
+    osc->inc = freq / sample_rate;
+}
+
+float osc_next(Osc *osc) {
+    float value;
+    osc_kernels[osc->kind](&value, 1, osc->phase, osc->inc);
+    osc->phase = frac(osc->phase + osc->inc);
+    return value;
+}
+
+void osc_fill(Osc *osc, float *out, int n) {
+    osc_kernels[osc->kind](out, n, osc->phase, osc->inc);
+    osc->phase = frac(osc->phase + n * osc->inc);
+}
+
+const char *osc_block_simd(void) {
+    return OSC_SIMD;
+}
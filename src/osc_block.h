@@ -0,0 +1,39 @@
+#ifndef OSC_BLOCK_H
+#define OSC_BLOCK_H
+
+// Block oscillator kernels. Each fills out[0..n) with one waveform at
+// phases phase + i * inc, in cycles. The sine uses a degree-7 polynomial
+// with an absolute error below 6e-7; including float phase rounding the
+// output stays within 2e-6 (about -114 dB) of libm sin(). The vector width
+// is picked at build time: AVX, SSE2, NEON or scalar.
+
+void osc_block_sin(float *out, int n, double phase, double inc);
+void osc_block_saw(float *out, int n, double phase, double inc);
+void osc_block_sq(float *out, int n, double phase, double inc);
+void osc_block_tri(float *out, int n, double phase, double inc);
+
+// Stateful oscillator: a phase accumulator in cycles, wrapped to [0, 1)
+// after every step so it keeps full precision however long it runs, and
+// changing the frequency never jumps the phase.
+enum {
+    OSC_SIN = 0,
+    OSC_SAW,
+    OSC_SQ,
+    OSC_TRI
+};
+
+typedef struct Osc {
+    int kind;
+    double phase;             // cycles, in [0, 1)
+    double inc;               // cycles per sample
+} Osc;
+
+void osc_init(Osc *osc, int kind, double freq, double sample_rate);
+void osc_set_freq(Osc *osc, double freq, double sample_rate);
+float osc_next(Osc *osc);
+void osc_fill(Osc *osc, float *out, int n);
+
+// Name of the kernel set compiled in ("avx", "sse2", "neon", "scalar")
+const char *osc_block_simd(void);
+
+#endif // OSC_BLOCK_H
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pool.h"
+
+// Bytes per page; the first POOL_GRAIN bytes link the pages
+#define POOL_PAGE (64 * 1024)
+
+static int class_of(size_t size) {
+    return (int)((size + POOL_GRAIN - 1) / POOL_GRAIN) - 1;
+}
+
+static size_t class_size(int c) {
+    return (size_t)(c + 1) * POOL_GRAIN;
+}
+
+void pool_init(Pool *pool, size_t limit) {
+    memset(pool, 0, sizeof(*pool));
+    pool->limit = limit;
+}
+
+void pool_destroy(Pool *pool) {
+    void *page = pool->pages;
+    while (page) {
+        void *next = *(void **)page;
+        free(page);
+        page = next;
+    }
+    pool_init(pool, pool->limit);
+}
+
+static void small_free(Pool *pool, void *block, int c) {
+    *(void **)block = pool->free[c];
+    pool->free[c] = block;
+}
+
+static void *small_alloc(Pool *pool, int c) {
+    void *block = pool->free[c];
+    if (block) {
+        pool->free[c] = *(void **)block;
+        return block;
+    }
+
+    size_t size = class_size(c);
+    if (pool->bump + size > pool->bump_end) {
+        char *page = (char *)malloc(POOL_PAGE);
+        if (!page) {
+            return NULL;
+        }
+        // Hand the tail of the old page to the largest class it fits
+        size_t rest = (size_t)(pool->bump_end - pool->bump);
+        if (rest >= POOL_GRAIN) {
+            small_free(pool, pool->bump, (int)(rest / POOL_GRAIN) - 1);
+        }
+        *(void **)page = pool->pages;
+        pool->pages = page;
+        pool->bump = page + POOL_GRAIN;
+        pool->bump_end = page + POOL_PAGE;
+    }
+    block = pool->bump;
+    pool->bump += size;
+    return block;
+}
+
+void *pool_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    Pool *pool = (Pool *)ud;
+    if (!ptr) {
+        osize = 0; // Lua 5.2+ pass the object type here
+    }
+    int was_small = osize > 0 && osize <= POOL_SMALL;
+
+    if (nsize == 0) {
+        if (was_small) {
+            small_free(pool, ptr, class_of(osize));
+        } else {
+            free(ptr);
+        }
+        pool->used -= osize;
+        return NULL;
+    }
+    if (nsize > osize && pool->limit && pool->used - osize + nsize > pool->limit) {
+        pool->failures++;
+        return NULL;
+    }
+
+    void *block;
+    if (nsize <= POOL_SMALL) {
+        if (was_small && class_of(osize) == class_of(nsize)) {
+            block = ptr;
+        } else {
+            block = small_alloc(pool, class_of(nsize));
+        }
+    } else if (osize > POOL_SMALL) {
+        block = realloc(ptr, nsize);
+        ptr = block ? NULL : ptr;
+    } else {
+        block = malloc(nsize);
+    }
+
+    if (!block) {
+        if (nsize > osize) {
+            return NULL;
+        }
+        // Lua expects shrinking to succeed; the block it has is big enough
+        block = ptr;
+        ptr = NULL;
+    }
+    if (ptr && block != ptr) {
+        memcpy(block, ptr, osize < nsize ? osize : nsize);
+        if (was_small) {
+            small_free(pool, ptr, class_of(osize));
+        } else {
+            free(ptr);
+        }
+    }
+
+    pool->used = pool->used - osize + nsize;
+    if (pool->used > pool->peak) {
+        pool->peak = pool->used;
+    }
+    return block;
+}
@@ -0,0 +1,36 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// lua_Alloc for one lua_State. Small blocks (most strings, tables and
+// closures) come from size-class free lists carved out of 64 KB pages, so
+// allocating and freeing them is a list push or pop that never calls
+// malloc once the pages exist. Larger blocks go to malloc. A pool is used
+// by one thread at a time, like the Script that owns it.
+
+// Size classes are POOL_GRAIN bytes apart, up to POOL_SMALL bytes
+#define POOL_GRAIN 16
+#define POOL_SMALL 512
+#define POOL_CLASSES (POOL_SMALL / POOL_GRAIN)
+
+typedef struct Pool {
+    void *free[POOL_CLASSES];   // free blocks of each class, linked through their first word
+    void *pages;                // every page, linked through their first word
+    char *bump;                 // unused rest of the newest page
+    char *bump_end;
+    size_t used;                // bytes Lua holds, as it asked for them
+    size_t peak;
+    size_t limit;               // growth past this fails (0 = no limit)
+    unsigned long failures;     // allocations refused by the limit
+} Pool;
+
+void pool_init(Pool *pool, size_t limit);
+
+// Release every page (after lua_close)
+void pool_destroy(Pool *pool);
+
+// lua_Alloc with ud = the Pool
+void *pool_alloc(void *ud, void *ptr, size_t osize, size_t nsize);
+
+#endif // POOL_H
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pure.h"
+#include "rt.h"
+#include "script.h"
+#include "thread.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+// Blocks kept in flight per worker, so a worker has the next one queued
+// while the track reads the one it just finished
+#define PURE_SLOTS_PER_WORKER 2
+// Share of a block's time each worker spends collecting garbage after it
+#define PURE_GC_SLACK 0.5
+
+enum {
+    SLOT_QUEUED = 0,
+    SLOT_BUSY,
+    SLOT_DONE,
+    SLOT_FAILED               // handed back: the track renders it itself
+};
+
+// One block ahead of the track
+typedef struct Slot {
+    unsigned long long frame;
+    unsigned int generation;  // bumped when the slot is given a new block
+    int state;
+    float *buf;
+} Slot;
+
+typedef struct Worker {
+    struct Pure *pure;
+    Thread thread;
+    Script *script;
+    int version;              // version of the script loaded, -1 for none
+    float *buf;               // rendered into outside the lock
+} Worker;
+
+struct Pure {
+    char path[256];
+    int sample_rate;
+    int block_size;
+    int channels;
+    int priority;
+    double watchdog;
+    int count;
+    Worker workers[PURE_MAX_WORKERS];
+    Slot slots[PURE_MAX_WORKERS * PURE_SLOTS_PER_WORKER];
+    int slot_count;
+    // Read position: 'offset' frames into slots[head], at frame 'pos'
+    int head;
+    int offset;
+    unsigned long long pos;
+    int version;              // version the workers should have loaded, -1 for none
+    ScriptSource *source;     // its text, as compiled into the live script
+    int ready;                // workers that have it
+    int failed;               // a worker can't render this version (it didn't
+                              // load, was muted or scheduled events)
+    int running;
+    Mutex lock;
+    Cond work;                // slots were queued or the version changed
+    Cond done;                // a slot was rendered
+};
+
+int pure_default_workers(void) {
+    long cpus;
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    cpus = (long)info.dwNumberOfProcessors;
+#else
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (cpus - 1 > PURE_MAX_WORKERS) return PURE_MAX_WORKERS;
+    return cpus > 2 ? (int)cpus - 1 : 1;
+}
+
+// Queue the blocks from frame on, in order (lock held)
+static void pure_reset(Pure *pure, unsigned long long frame) {
+    for (int i = 0; i < pure->slot_count; i++) {
+        Slot *slot = &pure->slots[i];
+        slot->frame = frame + (unsigned long long)i * pure->block_size;
+        slot->generation++;
+        slot->state = SLOT_QUEUED;
+    }
+    pure->head = 0;
+    pure->offset = 0;
+    pure->pos = frame;
+    cond_broadcast(&pure->work);
+}
+
+// Earliest queued block (lock held)
+static Slot *next_slot(Pure *pure) {
+    Slot *first = NULL;
+    for (int i = 0; i < pure->slot_count; i++) {
+        Slot *slot = &pure->slots[i];
+        if (slot->state == SLOT_QUEUED && (!first || slot->frame < first->frame)) {
+            first = slot;
+        }
+    }
+    return first;
+}
+
+static void *worker_func(void *arg) {
+    Worker *worker = (Worker *)arg;
+    Pure *pure = worker->pure;
+    const size_t bytes = (size_t)pure->block_size * pure->channels * sizeof(float);
+
+    if (pure->priority > 0) {
+        rt_thread(pure->priority, -1, pure->path);
+    }
+    mutex_lock(&pure->lock);
+    while (pure->running) {
+        // Load the script again after every reload, off the track's thread
+        if (worker->version != pure->version) {
+            int version = pure->version;
+            unsigned long long frame = pure->pos;
+            ScriptSource *source = pure->source;
+            script_source_retain(source);
+            mutex_unlock(&pure->lock);
+            script_free(worker->script);
+            worker->script = script_open_source(pure->path, source, pure->sample_rate,
+                                                pure->block_size, pure->channels,
+                                                pure->watchdog, frame);
+            script_source_release(source);
+            if (worker->script) {
+                script_gc_pause(worker->script);
+            }
+            mutex_lock(&pure->lock);
+            worker->version = version;
+            if (version == pure->version) {
+                if (worker->script) {
+                    pure->ready++;
+                } else {
+                    pure->failed = 1;
+                    cond_broadcast(&pure->done);
+                }
+            }
+            continue;
+        }
+
+        Slot *slot = worker->script && !pure->failed ? next_slot(pure) : NULL;
+        if (!slot) {
+            cond_wait(&pure->work, &pure->lock);
+            continue;
+        }
+        slot->state = SLOT_BUSY;
+        unsigned int generation = slot->generation;
+        worker->script->frame = slot->frame;
+        mutex_unlock(&pure->lock);
+
+        script_render(worker->script, worker->buf, pure->block_size, worker->script->gain);
+        script_collect(worker->script, PURE_GC_SLACK * pure->block_size / pure->sample_rate);
+        // A muted copy would silence every few blocks, and events would
+        // each fire in whichever copy renders their block: hand it back
+        int unfit = worker->script->muted || worker->script->sched.count > 0;
+
+        mutex_lock(&pure->lock);
+        // Unless the track jumped meanwhile and gave the slot another block
+        if (slot->generation == generation) {
+            if (unfit) {
+                slot->state = SLOT_FAILED;
+                pure->failed = 1;
+            } else {
+                memcpy(slot->buf, worker->buf, bytes);
+                slot->state = SLOT_DONE;
+            }
+            cond_broadcast(&pure->done);
+        }
+    }
+    mutex_unlock(&pure->lock);
+
+    script_free(worker->script);
+    worker->script = NULL;
+    return NULL;
+}
+
+Pure *pure_start(const char *path, int sample_rate, int block_size, int channels,
+                 int workers, double watchdog, int priority) {
+    if (workers < 1) workers = 1;
+    if (workers > PURE_MAX_WORKERS) workers = PURE_MAX_WORKERS;
+
+    Pure *pure = (Pure *)calloc(1, sizeof(Pure));
+    if (!pure) {
+        return NULL;
+    }
+    snprintf(pure->path, sizeof(pure->path), "%s", path);
+    pure->sample_rate = sample_rate;
+    pure->block_size = block_size;
+    pure->channels = channels;
+    pure->priority = priority;
+    // Each worker has 'workers' blocks of real time for every block it
+    // renders, so the budget of a block grows with the pool
+    pure->watchdog = watchdog * workers;
+    pure->slot_count = workers * PURE_SLOTS_PER_WORKER;
+    // Workers start with nothing to load, until the first read
+    pure->version = -1;
+    const size_t bytes = (size_t)block_size * channels * sizeof(float);
+    for (int i = 0; i < pure->slot_count; i++) {
+        pure->slots[i].buf = (float *)malloc(bytes);
+        if (!pure->slots[i].buf) {
+            pure_stop(pure);
+            return NULL;
+        }
+    }
+    mutex_init(&pure->lock);
+    cond_init(&pure->work);
+    cond_init(&pure->done);
+    pure->running = 1;
+
+    for (int i = 0; i < workers; i++) {
+        Worker *worker = &pure->workers[i];
+        worker->pure = pure;
+        worker->version = pure->version;
+        worker->buf = (float *)malloc(bytes);
+        if (!worker->buf || thread_start(&worker->thread, worker_func, worker) != 0) {
+            free(worker->buf);
+            worker->buf = NULL;
+            fprintf(stderr, "Error: Failed to start the workers for %s\n", path);
+            pure_stop(pure);
+            return NULL;
+        }
+        pure->count++;
+    }
+    return pure;
+}
+
+int pure_read(Pure *pure, float *out, unsigned long long frame, int n, int version,
+              ScriptSource *source) {
+    const int ch = pure->channels;
+    const int block = pure->block_size;
+
+    mutex_lock(&pure->lock);
+    if (version != pure->version) {
+        script_source_retain(source);
+        script_source_release(pure->source);
+        pure->source = source;
+        pure->version = version;
+        pure->ready = 0;
+        pure->failed = 0;
+        pure_reset(pure, frame);
+    } else if (pure->failed) {
+        // Nothing more to render ahead until the next version
+        mutex_unlock(&pure->lock);
+        return 0;
+    } else if (frame != pure->pos) {
+        pure_reset(pure, frame);
+    }
+
+    int done = 0;
+    while (done < n && pure->ready > 0 && !pure->failed) {
+        Slot *slot = &pure->slots[pure->head];
+        if (slot->state != SLOT_DONE) {
+            cond_wait(&pure->done, &pure->lock);
+            continue;
+        }
+        int len = block - pure->offset;
+        if (len > n - done) len = n - done;
+        memcpy(out + (size_t)done * ch, slot->buf + (size_t)pure->offset * ch,
+               (size_t)len * ch * sizeof(float));
+        done += len;
+        pure->offset += len;
+        pure->pos += (unsigned long long)len;
+        if (pure->offset == block) {
+            // Read: reuse the slot for the block after the last one queued
+            slot->frame += (unsigned long long)pure->slot_count * block;
+            slot->generation++;
+            slot->state = SLOT_QUEUED;
+            pure->head = (pure->head + 1) % pure->slot_count;
+            pure->offset = 0;
+            cond_broadcast(&pure->work);
+        }
+    }
+    mutex_unlock(&pure->lock);
+    return done;
+}
+
+void pure_stop(Pure *pure) {
+    if (!pure) {
+        return;
+    }
+    if (pure->count > 0) {
+        mutex_lock(&pure->lock);
+        pure->running = 0;
+        cond_broadcast(&pure->work);
+        mutex_unlock(&pure->lock);
+        for (int i = 0; i < pure->count; i++) {
+            thread_join(pure->workers[i].thread);
+            free(pure->workers[i].buf);
+        }
+    }
+    if (pure->running || pure->count > 0) {
+        cond_destroy(&pure->work);
+        cond_destroy(&pure->done);
+        mutex_destroy(&pure->lock);
+    }
+    for (int i = 0; i < pure->slot_count; i++) {
+        free(pure->slots[i].buf);
+    }
+    script_source_release(pure->source);
+    free(pure);
+}
@@ -0,0 +1,42 @@
+#ifndef PURE_H
+#define PURE_H
+
+// Speculative rendering for pure scripts, whose main depends on t alone.
+// A pool of worker threads, each with its own lua_State running the same
+// script, renders the next blocks of the track concurrently; the track
+// reads them back in order. Blocks rendered ahead are thrown away when
+// the track jumps (a reload or a catch-up) and rendered again from there.
+
+#include "script.h"
+
+#define PURE_MAX_WORKERS 16
+
+typedef struct Pure Pure;
+
+// Workers to use by default: one per CPU but one, at least one
+int pure_default_workers(void);
+
+// Start 'workers' threads (at most PURE_MAX_WORKERS) at the given thread
+// priority, to render the script at path with the script_open settings
+// once the first read hands them its source. The per-block watchdog is
+// multiplied by the number of workers. NULL on failure.
+Pure *pure_start(const char *path, int sample_rate, int block_size, int channels,
+                 int workers, double watchdog, int priority);
+
+// Copy up to n frames from 'frame' of version 'version' of the script
+// into out, waiting for the workers if need be, and return how many were
+// copied; the caller renders the rest itself. A new version comes with
+// the source text the live script was compiled from, which each worker
+// compiles into its own copy. A frame or a version other than where the
+// last read ended discards what was rendered ahead. Nothing is copied
+// while no worker has the version loaded yet (just after a reload), and
+// from the first block a worker hands back on: when a copy fails to load,
+// is muted by the watchdog or schedules events, the pool stops rendering
+// that version.
+int pure_read(Pure *pure, float *out, unsigned long long frame, int n, int version,
+              ScriptSource *source);
+
+// Stop the workers and free their scripts
+void pure_stop(Pure *pure);
+
+#endif // PURE_H
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sndfile.h>
+#include "record.h"
+#include "render.h"
+#include "ringbuf.h"
+#include "stats.h"
+#include "thread.h"
+
+// Seconds of audio queued for the writer, to ride out slow disks
+#define RECORD_BUFFER_S 4
+// Frames per write
+#define RECORD_CHUNK 16384
+// How often the writer drains the queue while recording
+#define RECORD_WAKE_MS 50
+// Seconds between syncs of the file to disk
+#define RECORD_SYNC_S 2.0
+
+static struct {
+    RingBuffer rb;            // mixer -> writer
+    Thread thread;
+    Semaphore wake;
+    Mutex lock;               // guards the request
+    char request[1024];       // file to record next, "" to stop
+    int has_request;
+    char last[1024];          // file of the last request, "" after a stop
+    atomic_int running;
+    atomic_int active;        // a file is open, the mixer queues frames
+    atomic_ullong dropped;
+    int sample_rate;
+    int channels;
+    int initialized;
+} recorder;
+
+// Take the pending request, if any, into path
+static int take_request(char *path, size_t size) {
+    mutex_lock(&recorder.lock);
+    int has_request = recorder.has_request;
+    if (has_request) {
+        snprintf(path, size, "%s", recorder.request);
+        recorder.has_request = 0;
+    }
+    mutex_unlock(&recorder.lock);
+    return has_request;
+}
+
+// Queue a start (or a stop, for ""), unless it repeats the last one
+static void post_request(const char *path) {
+    mutex_lock(&recorder.lock);
+    int repeat = strcmp(recorder.last, path) == 0;
+    if (!repeat) {
+        snprintf(recorder.request, sizeof(recorder.request), "%s", path);
+        snprintf(recorder.last, sizeof(recorder.last), "%s", path);
+        recorder.has_request = 1;
+    }
+    mutex_unlock(&recorder.lock);
+    if (!repeat) {
+        semaphore_post(&recorder.wake);
+    }
+}
+
+static SNDFILE *open_file(const char *path) {
+    SF_INFO info = {0};
+    info.samplerate = recorder.sample_rate;
+    info.channels = recorder.channels;
+    info.format = render_format(path);
+    if (!sf_format_check(&info)) {
+        fprintf(stderr, "Error: Unsupported recording format for %s\n", path);
+        return NULL;
+    }
+    SNDFILE *file = sf_open(path, SFM_WRITE, &info);
+    if (!file) {
+        fprintf(stderr, "Error opening %s: %s\n", path, sf_strerror(NULL));
+    }
+    return file;
+}
+
+// Write everything queued; 0 on success
+static int drain(SNDFILE *file, float *chunk) {
+    unsigned int got;
+    while ((got = rb_read(&recorder.rb, chunk, RECORD_CHUNK)) > 0) {
+        if (sf_writef_float(file, chunk, got) != (sf_count_t)got) {
+            fprintf(stderr, "Error writing the recording: %s\n", sf_strerror(file));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void close_file(SNDFILE *file, float *chunk, const char *path) {
+    atomic_store(&recorder.active, 0);
+    drain(file, chunk);
+    sf_close(file);
+    printf("Recording saved to %s\n", path);
+}
+
+// Writer thread: opens and closes files on request and streams the queue
+// into the open one
+static void *record_func(void *arg) {
+    (void)arg;
+    float *chunk = (float *)malloc((size_t)RECORD_CHUNK * recorder.channels * sizeof(float));
+    SNDFILE *file = NULL;
+    char current[1024] = "";
+    char path[1024];
+    double last_sync = 0.0;
+
+    while (chunk && atomic_load(&recorder.running)) {
+        if (file) {
+            semaphore_timedwait(&recorder.wake, RECORD_WAKE_MS);
+        } else {
+            semaphore_wait(&recorder.wake);
+        }
+
+        if (take_request(path, sizeof(path))) {
+            if (file) {
+                close_file(file, chunk, current);
+                file = NULL;
+            }
+            if (path[0] && (file = open_file(path)) != NULL) {
+                // Leftovers from a previous recording belong to no file
+                rb_discard(&recorder.rb);
+                snprintf(current, sizeof(current), "%s", path);
+                last_sync = stats_now();
+                atomic_store(&recorder.active, 1);
+                printf("Recording to %s\n", path);
+            } else if (path[0]) {
+                // Let the same path be asked for again
+                mutex_lock(&recorder.lock);
+                if (strcmp(recorder.last, path) == 0) {
+                    recorder.last[0] = '\0';
+                }
+                mutex_unlock(&recorder.lock);
+            }
+        }
+
+        if (file && drain(file, chunk) != 0) {
+            close_file(file, chunk, current);
+            file = NULL;
+        } else if (file && stats_now() - last_sync >= RECORD_SYNC_S) {
+            sf_write_sync(file);
+            last_sync = stats_now();
+        }
+    }
+
+    if (file) {
+        close_file(file, chunk, current);
+    }
+    free(chunk);
+    return NULL;
+}
+
+int record_init(int sample_rate, int channels) {
+    if (recorder.initialized) {
+        return 0;
+    }
+    recorder.sample_rate = sample_rate;
+    recorder.channels = channels;
+    recorder.has_request = 0;
+    recorder.last[0] = '\0';
+    atomic_store(&recorder.active, 0);
+    atomic_store(&recorder.dropped, 0);
+    if (rb_init(&recorder.rb, (unsigned int)(RECORD_BUFFER_S * sample_rate), (unsigned int)channels) != 0) {
+        fprintf(stderr, "Error: Failed to allocate the recording buffer\n");
+        return 1;
+    }
+    if (semaphore_init(&recorder.wake) != 0) {
+        fprintf(stderr, "Error: Failed to create the recorder semaphore\n");
+        rb_free(&recorder.rb);
+        return 1;
+    }
+    mutex_init(&recorder.lock);
+    atomic_store(&recorder.running, 1);
+    if (thread_start(&recorder.thread, record_func, NULL) != 0) {
+        fprintf(stderr, "Error: Failed to start the recorder thread\n");
+        mutex_destroy(&recorder.lock);
+        semaphore_destroy(&recorder.wake);
+        rb_free(&recorder.rb);
+        return 1;
+    }
+    recorder.initialized = 1;
+    return 0;
+}
+
+void record_shutdown(void) {
+    if (!recorder.initialized) {
+        return;
+    }
+    atomic_store(&recorder.running, 0);
+    semaphore_post(&recorder.wake);
+    thread_join(recorder.thread);
+    mutex_destroy(&recorder.lock);
+    semaphore_destroy(&recorder.wake);
+    rb_free(&recorder.rb);
+    recorder.initialized = 0;
+}
+
+int record_start(const char *path) {
+    if (!recorder.initialized) {
+        fprintf(stderr, "Recording is only available when playing live\n");
+        return 1;
+    }
+    if (!path[0] || strlen(path) >= sizeof(recorder.request)) {
+        fprintf(stderr, "Invalid recording path\n");
+        return 1;
+    }
+    post_request(path);
+    return 0;
+}
+
+void record_stop(void) {
+    if (recorder.initialized) {
+        post_request("");
+    }
+}
+
+void record_write(const float *frames, unsigned int n) {
+    if (!atomic_load(&recorder.active)) {
+        return;
+    }
+    // Whole blocks or nothing, so the file has gaps rather than glitches
+    if (rb_space(&recorder.rb) < n) {
+        atomic_fetch_add(&recorder.dropped, n);
+        return;
+    }
+    rb_write(&recorder.rb, frames, n);
+}
+
+unsigned long long record_dropped(void) {
+    return atomic_load(&recorder.dropped);
+}
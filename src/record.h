@@ -0,0 +1,33 @@
+#ifndef RECORD_H
+#define RECORD_H
+
+// Recording of the live output to disk. The mixer hands every block it
+// has mixed to record_write, which only copies it into a lock-free ring;
+// a writer thread drains the ring into the file through libsndfile in
+// large sequential writes and syncs it every few seconds. When the disk
+// falls behind and the ring fills up, blocks are dropped and counted,
+// so recording never makes the mixer wait.
+
+// Start the writer thread for output of this layout; 0 on success
+int record_init(int sample_rate, int channels);
+
+// Finish any recording and stop the writer thread
+void record_shutdown(void);
+
+// Ask the writer to record into path (format picked from the extension
+// like offline renders), closing the file being recorded if any. Asking
+// for the file already being recorded changes nothing, so a script can
+// start a recording at its top and still be reloaded. 0 if the request
+// was queued; the writer reports whether the file could be opened.
+int record_start(const char *path);
+
+// Ask the writer to finish and close the current file
+void record_stop(void);
+
+// Mixer: queue n interleaved frames if a file is being recorded
+void record_write(const float *frames, unsigned int n);
+
+// Frames dropped so far because the writer fell behind
+unsigned long long record_dropped(void);
+
+#endif // RECORD_H
@@ -0,0 +1,220 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "reload.h"
+#include "thread.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+// How often the watcher wakes up to collect retired scripts or poll mtime
+#define RELOAD_POLL_MS 100
+// Editors often write a file in several steps: let them settle first
+#define RELOAD_SETTLE_MS 20
+
+static Track *watch_tracks;
+static int watch_count;
+static Thread watcher_thread;
+static atomic_int watching;
+
+static void sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000L};
+    nanosleep(&ts, NULL);
+#endif
+}
+
+static long file_mtime(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (long)st.st_mtime : 0;
+}
+
+// Close the lua_States (and stop the pools of pure workers) the render
+// threads swapped out, off the audio path
+static void collect_retired(void) {
+    for (int i = 0; i < watch_count; i++) {
+        Script *retired = atomic_exchange(&watch_tracks[i].retired, NULL);
+        if (retired) {
+            script_free(retired);
+        }
+        pure_stop(atomic_exchange(&watch_tracks[i].retired_pool, NULL));
+    }
+}
+
+// Compile the script in a fresh lua_State and queue it for the track
+static void reload_script(Track *track) {
+    // Under the track's watchdog, so a script stuck in a loop can't hang
+    // the watcher (and with it every later reload). The top level runs at
+    // the live position, so events it schedules in the past aren't all
+    // fired at once after the swap.
+    const unsigned long long frame = atomic_load(&track->frame);
+    Script *script = script_open(track->path, track->render_rate, track->block_size,
+                                 track->channels, track->watchdog, frame);
+    if (!script) {
+        fprintf(stderr, "Reload failed, keeping the running %s\n", track->path);
+        return;
+    }
+
+    // Warm up at the live position, so the first block rendered for real
+    // doesn't pay for first-call costs (and LuaJIT has traces ready).
+    // Events stay put, so none is used up by a block nobody hears.
+    float *scratch = (float *)malloc((size_t)track->block_size * track->channels * sizeof(float));
+    if (scratch) {
+        script->frame = frame;
+        script->hold_events = 1;
+        script_render(script, scratch, track->block_size, 0.0f);
+        script->hold_events = 0;
+        free(scratch);
+        if (script->strikes > 0) {
+            fprintf(stderr, "Reload failed, keeping the running %s\n", track->path);
+            script_free(script);
+            return;
+        }
+    }
+
+    // A newer script replaces one the render thread hasn't picked up yet
+    Script *stale = atomic_exchange(&track->pending, script);
+    if (stale) {
+        script_free(stale);
+    }
+    printf("Reloaded %s\n", track->path);
+}
+
+#ifdef __linux__
+// Watch each script's directory, since many editors save by renaming a
+// new file over the old one. Returns 1 if inotify is unavailable.
+static int watch_inotify(void) {
+    int wds[TRACK_MAX];
+    const char *names[TRACK_MAX];
+
+    int fd = inotify_init();
+    if (fd < 0) {
+        return 1;
+    }
+    for (int i = 0; i < watch_count; i++) {
+        const char *path = watch_tracks[i].path;
+        const char *name = strrchr(path, '/');
+        char dir[256];
+        if (name) {
+            snprintf(dir, sizeof(dir), "%.*s", (int)(name - path), path);
+            name++;
+        } else {
+            snprintf(dir, sizeof(dir), ".");
+            name = path;
+        }
+        if (dir[0] == '\0') {
+            snprintf(dir, sizeof(dir), "/");
+        }
+
+        // Scripts in the same directory share one watch descriptor
+        names[i] = name;
+        wds[i] = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wds[i] < 0) {
+            close(fd);
+            return 1;
+        }
+    }
+
+    _Alignas(struct inotify_event) char events[4096];
+    while (atomic_load(&watching)) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, RELOAD_POLL_MS);
+        collect_retired();
+        if (ready <= 0) {
+            continue;
+        }
+
+        int changed[TRACK_MAX] = {0};
+        do {
+            ssize_t len = read(fd, events, sizeof(events));
+            for (ssize_t off = 0; off < len;) {
+                const struct inotify_event *ev = (const struct inotify_event *)(events + off);
+                for (int i = 0; i < watch_count && ev->len > 0; i++) {
+                    if (ev->wd == wds[i] && strcmp(ev->name, names[i]) == 0) {
+                        changed[i] = 1;
+                    }
+                }
+                off += (ssize_t)sizeof(struct inotify_event) + ev->len;
+            }
+            // Coalesce the burst of events a single save produces
+            sleep_ms(RELOAD_SETTLE_MS);
+            pfd.revents = 0;
+        } while (poll(&pfd, 1, 0) > 0);
+
+        for (int i = 0; i < watch_count; i++) {
+            if (changed[i]) {
+                reload_script(&watch_tracks[i]);
+            }
+        }
+    }
+    close(fd);
+    return 0;
+}
+#endif
+
+// Portable fallback: compare the files' mtimes periodically
+static void watch_mtime(void) {
+    long last[TRACK_MAX];
+    for (int i = 0; i < watch_count; i++) {
+        last[i] = file_mtime(watch_tracks[i].path);
+    }
+    while (atomic_load(&watching)) {
+        sleep_ms(RELOAD_POLL_MS);
+        collect_retired();
+        for (int i = 0; i < watch_count; i++) {
+            long mtime = file_mtime(watch_tracks[i].path);
+            if (mtime != 0 && mtime != last[i]) {
+                last[i] = mtime;
+                sleep_ms(RELOAD_SETTLE_MS);
+                reload_script(&watch_tracks[i]);
+            }
+        }
+    }
+}
+
+static void *watcher_func(void *arg) {
+    (void)arg;
+#ifdef __linux__
+    if (watch_inotify() == 0) {
+        return NULL;
+    }
+    fprintf(stderr, "Warning: inotify unavailable, polling scripts for changes\n");
+#endif
+    watch_mtime();
+    return NULL;
+}
+
+int reload_start(Track *tracks, int count) {
+    if (atomic_load(&watching)) {
+        return 0;
+    }
+    watch_tracks = tracks;
+    watch_count = count < TRACK_MAX ? count : TRACK_MAX;
+    atomic_store(&watching, 1);
+    if (thread_start(&watcher_thread, watcher_func, NULL) != 0) {
+        atomic_store(&watching, 0);
+        return 1;
+    }
+    return 0;
+}
+
+void reload_stop(void) {
+    if (!atomic_load(&watching)) {
+        return;
+    }
+    atomic_store(&watching, 0);
+    thread_join(watcher_thread);
+    // Scripts still in flight are freed by track_close
+}
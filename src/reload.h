@@ -0,0 +1,16 @@
+#ifndef RELOAD_H
+#define RELOAD_H
+
+#include "track.h"
+
+// Watch the tracks' script files on a separate thread (inotify on Linux,
+// mtime polling elsewhere). On a change, the script is compiled and warmed
+// up in a fresh lua_State and handed to the track's render thread through
+// track->pending; a script that fails to load is reported and the live one
+// keeps playing. Each track reloads independently of the others.
+int reload_start(Track *tracks, int count);
+
+// Call once the render threads have stopped, before closing the tracks
+void reload_stop(void);
+
+#endif // RELOAD_H
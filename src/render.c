@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sndfile.h>
+#include "render.h"
+
+int render_format(const char *path) {
+    char ext[8] = {0};
+    const char *dot = strrchr(path, '.');
+    if (dot) {
+        for (int i = 0; dot[i + 1] && i < (int)sizeof(ext) - 1; i++) {
+            ext[i] = (char)tolower((unsigned char)dot[i + 1]);
+        }
+    }
+
+    if (strcmp(ext, "flac") == 0) return SF_FORMAT_FLAC | SF_FORMAT_PCM_24;
+    if (strcmp(ext, "aiff") == 0 || strcmp(ext, "aif") == 0) return SF_FORMAT_AIFF | SF_FORMAT_PCM_24;
+    if (strcmp(ext, "ogg") == 0) return SF_FORMAT_OGG | SF_FORMAT_VORBIS;
+    // WAV stores the generator output bit for bit
+    return SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+}
+
+// Wall clock time in seconds; clock() would add up the CPU time of
+// every render thread
+static double wall_time(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int render_offline(AudioState *state, const char *path, double duration) {
+    SF_INFO info = {0};
+    info.samplerate = state->sample_rate;
+    info.channels = state->channels;
+    info.format = render_format(path);
+    if (!sf_format_check(&info)) {
+        fprintf(stderr, "Error: Unsupported output format for %s\n", path);
+        return 1;
+    }
+
+    SNDFILE *file = sf_open(path, SFM_WRITE, &info);
+    if (!file) {
+        fprintf(stderr, "Error opening %s: %s\n", path, sf_strerror(NULL));
+        return 1;
+    }
+
+    const size_t frames = (size_t)state->buffer_size * state->channels;
+    float *block = (float *)malloc(frames * sizeof(float));
+    float *scratch = (float *)malloc(frames * sizeof(float));
+    if (!block || !scratch) {
+        fprintf(stderr, "Error: Failed to allocate render buffer\n");
+        free(block);
+        free(scratch);
+        sf_close(file);
+        return 1;
+    }
+
+    long long total = (long long)(duration * state->sample_rate + 0.5);
+    long long done = 0;
+    int result = 0;
+    double start = wall_time();
+
+    // Tracks render in parallel on their own threads; the mixer waits for
+    // each of them, so the output doesn't depend on thread timing
+    for (int i = 0; i < state->track_count; i++) {
+        if (track_start(&state->tracks[i]) != 0) {
+            fprintf(stderr, "Error: Failed to start render thread for %s\n", state->tracks[i].path);
+            result = 1;
+            total = 0;
+            break;
+        }
+    }
+
+    while (done < total) {
+        int n = state->buffer_size;
+        if (total - done < n) n = (int)(total - done);
+        track_mix(state->tracks, state->track_count, block, scratch, (unsigned int)n, state->volume, 1);
+        if (sf_writef_float(file, block, n) != n) {
+            fprintf(stderr, "Error writing %s: %s\n", path, sf_strerror(file));
+            result = 1;
+            break;
+        }
+        done += n;
+    }
+
+    for (int i = 0; i < state->track_count; i++) {
+        track_stop(&state->tracks[i]);
+    }
+
+    double elapsed = wall_time() - start;
+    double rendered = (double)done / state->sample_rate;
+    if (result == 0) {
+        printf("Rendered %.2fs to %s in %.2fs", rendered, path, elapsed);
+        if (elapsed > 0.0) {
+            printf(" (%.1fx real time)", rendered / elapsed);
+        }
+        printf("\n");
+    }
+
+    free(block);
+    free(scratch);
+    sf_close(file);
+    return result;
+}
@@ -0,0 +1,14 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "audio.h"
+
+// Render duration seconds of state->tracks, mixed, to an audio file, as
+// fast as possible and without opening an audio device. The file format is
+// picked from the extension (.wav, .flac, .aiff, .ogg).
+int render_offline(AudioState *state, const char *path, double duration);
+
+// libsndfile format for an output file, picked from its extension
+int render_format(const char *path);
+
+#endif // RENDER_H
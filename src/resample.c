@@ -0,0 +1,132 @@
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resample.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define HALF (RESAMPLE_TAPS / 2)
+// Cutoff as a fraction of the input rate. The Blackman window widens the
+// transition to about +-2.75 / RESAMPLE_TAPS around it (0.39 to 0.47 at
+// 64 taps), so the stopband starts below the input's Nyquist frequency
+// and the images of the lower rate stay under -80 dB.
+#define CUTOFF 0.43
+
+// Kernel at distance d input samples from the output position
+static double kernel(double d) {
+    if (fabs(d) >= HALF) {
+        return 0.0;
+    }
+    double x = 2.0 * CUTOFF * d;
+    double sinc = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+    double w = (d + HALF) / (2.0 * HALF);
+    double window = 0.42 - 0.5 * cos(2.0 * M_PI * w) + 0.08 * cos(4.0 * M_PI * w);
+    return 2.0 * CUTOFF * sinc * window;
+}
+
+// Tap j of phase p weighs input floor(x) - HALF + 1 + j for an output at
+// x = floor(x) + p / RESAMPLE_PHASES. Each phase is normalized to unity
+// gain so DC passes unchanged whatever the fractional position.
+static void build_table(float *table) {
+    for (int p = 0; p <= RESAMPLE_PHASES; p++) {
+        double frac = (double)p / RESAMPLE_PHASES;
+        double c[RESAMPLE_TAPS];
+        double sum = 0.0;
+        for (int j = 0; j < RESAMPLE_TAPS; j++) {
+            c[j] = kernel(frac + HALF - 1 - j);
+            sum += c[j];
+        }
+        for (int j = 0; j < RESAMPLE_TAPS; j++) {
+            table[p * RESAMPLE_TAPS + j] = (float)(c[j] / sum);
+        }
+    }
+}
+
+int resampler_init(Resampler *rs, int in_rate, int out_rate, int channels, int max_out) {
+    memset(rs, 0, sizeof(*rs));
+    if (in_rate <= 0 || out_rate < in_rate) {
+        return 1;
+    }
+    rs->channels = channels;
+    rs->step = (double)in_rate / out_rate;
+    // History from before the read, plus the input of the longest read
+    rs->capacity = RESAMPLE_TAPS + (int)ceil(max_out * rs->step) + 2;
+    rs->table = (float *)malloc((size_t)(RESAMPLE_PHASES + 1) * RESAMPLE_TAPS * sizeof(float));
+    rs->history = (float *)malloc((size_t)rs->capacity * channels * sizeof(float));
+    if (!rs->table || !rs->history) {
+        resampler_free(rs);
+        return 1;
+    }
+    build_table(rs->table);
+    resampler_reset(rs);
+    return 0;
+}
+
+void resampler_free(Resampler *rs) {
+    free(rs->table);
+    free(rs->history);
+    rs->table = NULL;
+    rs->history = NULL;
+}
+
+void resampler_reset(Resampler *rs) {
+    // Silence before the first input sample, which the first output is on
+    rs->count = HALF - 1;
+    rs->pos = HALF - 1;
+    memset(rs->history, 0, (size_t)rs->count * rs->channels * sizeof(float));
+}
+
+int resampler_want(const Resampler *rs, int n) {
+    if (n <= 0) {
+        return 0;
+    }
+    int last = (int)floor(rs->pos + (n - 1) * rs->step);
+    int want = last + HALF + 1 - rs->count;
+    return want > 0 ? want : 0;
+}
+
+float *resampler_write_span(Resampler *rs, int n) {
+    float *span = rs->history + (size_t)rs->count * rs->channels;
+    rs->count += n;
+    return span;
+}
+
+void resampler_read(Resampler *rs, float *out, int n) {
+    const int ch = rs->channels;
+    float coef[RESAMPLE_TAPS];
+
+    for (int k = 0; k < n; k++) {
+        double x = rs->pos + k * rs->step;
+        int base = (int)x;
+        double phase = (x - base) * RESAMPLE_PHASES;
+        int p = (int)phase;
+        float t = (float)(phase - p);
+        const float *a = rs->table + p * RESAMPLE_TAPS;
+        const float *b = a + RESAMPLE_TAPS;
+        for (int j = 0; j < RESAMPLE_TAPS; j++) {
+            coef[j] = a[j] + (b[j] - a[j]) * t;
+        }
+
+        const float *in = rs->history + (size_t)(base - HALF + 1) * ch;
+        float *f = out + (size_t)k * ch;
+        for (int c = 0; c < ch; c++) {
+            float sum = 0.0f;
+            for (int j = 0; j < RESAMPLE_TAPS; j++) {
+                sum += coef[j] * in[j * ch + c];
+            }
+            f[c] = sum;
+        }
+    }
+
+    // Keep the input the next output frame still reaches back to
+    rs->pos += n * rs->step;
+    int drop = (int)rs->pos - (HALF - 1);
+    if (drop > 0) {
+        rs->count -= drop;
+        memmove(rs->history, rs->history + (size_t)drop * ch, (size_t)rs->count * ch * sizeof(float));
+        rs->pos -= drop;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+// Streaming windowed-sinc resampler from a lower render rate up to the
+// device rate. The kernel spans RESAMPLE_TAPS input samples (Blackman
+// window, stopband from just under the input's Nyquist frequency) and is
+// tabled at RESAMPLE_PHASES fractional positions, interpolated linearly
+// between them, so any pair of rates works and the ratio is never
+// rounded. The output lags the input by RESAMPLE_TAPS / 2 input samples.
+
+#define RESAMPLE_TAPS 64
+#define RESAMPLE_PHASES 256
+
+typedef struct Resampler {
+    int channels;
+    double step;              // input frames per output frame (<= 1)
+    double pos;               // input position of the next output frame, in history
+    float *table;             // (RESAMPLE_PHASES + 1) * RESAMPLE_TAPS coefficients
+    float *history;           // input frames, interleaved
+    int count;                // frames in history
+    int capacity;
+} Resampler;
+
+// Set up conversion from in_rate to out_rate (in_rate <= out_rate) for
+// reads of up to max_out frames; 0 on success
+int resampler_init(Resampler *rs, int in_rate, int out_rate, int channels, int max_out);
+void resampler_free(Resampler *rs);
+
+// Forget the input so far, as if just initialized
+void resampler_reset(Resampler *rs);
+
+// Input frames that must be written before n output frames can be read
+int resampler_want(const Resampler *rs, int n);
+
+// Room for n input frames (at most resampler_want of the next read),
+// which the caller fills before calling resampler_read
+float *resampler_write_span(Resampler *rs, int n);
+
+// Produce n interleaved output frames (n <= max_out)
+void resampler_read(Resampler *rs, float *out, int n);
+
+#endif // RESAMPLE_H
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ringbuf.h"
+
+int rb_init(RingBuffer *rb, unsigned int min_frames, unsigned int channels) {
+    unsigned int size = 1;
+    while (size < min_frames) {
+        size <<= 1;
+    }
+    rb->data = (float *)calloc((size_t)size * channels, sizeof(float));
+    if (!rb->data) {
+        return 1;
+    }
+    rb->size = size;
+    rb->mask = size - 1;
+    rb->channels = channels;
+    atomic_init(&rb->read, 0);
+    atomic_init(&rb->write, 0);
+    return 0;
+}
+
+void rb_free(RingBuffer *rb) {
+    free(rb->data);
+    rb->data = NULL;
+    rb->size = 0;
+    rb->mask = 0;
+    atomic_store(&rb->read, 0);
+    atomic_store(&rb->write, 0);
+}
+
+unsigned int rb_count(RingBuffer *rb) {
+    // Read first: write only grows past it, so w - r never wraps even for
+    // a third thread (stats) that owns neither position. Both may move in
+    // between, which can overstate the count, hence the clamp.
+    unsigned int r = atomic_load_explicit(&rb->read, memory_order_acquire);
+    unsigned int w = atomic_load_explicit(&rb->write, memory_order_acquire);
+    unsigned int count = w - r;
+    return count < rb->size ? count : rb->size;
+}
+
+unsigned int rb_space(RingBuffer *rb) {
+    return rb->size - rb_count(rb);
+}
+
+float *rb_write_span(RingBuffer *rb, unsigned int *len) {
+    unsigned int w = atomic_load_explicit(&rb->write, memory_order_relaxed);
+    unsigned int r = atomic_load_explicit(&rb->read, memory_order_acquire);
+    unsigned int space = rb->size - (w - r);
+    unsigned int to_end = rb->size - (w & rb->mask);
+    *len = space < to_end ? space : to_end;
+    return &rb->data[(w & rb->mask) * rb->channels];
+}
+
+void rb_commit_write(RingBuffer *rb, unsigned int n) {
+    unsigned int w = atomic_load_explicit(&rb->write, memory_order_relaxed);
+    atomic_store_explicit(&rb->write, w + n, memory_order_release);
+}
+
+unsigned int rb_write(RingBuffer *rb, const float *src, unsigned int n) {
+    unsigned int w = atomic_load_explicit(&rb->write, memory_order_relaxed);
+    unsigned int r = atomic_load_explicit(&rb->read, memory_order_acquire);
+    unsigned int space = rb->size - (w - r);
+    if (n > space) n = space;
+
+    // At most two spans: up to the end of the buffer, then from the start
+    const size_t frame = rb->channels * sizeof(float);
+    unsigned int pos = w & rb->mask;
+    unsigned int first = rb->size - pos;
+    if (first > n) first = n;
+    memcpy(&rb->data[pos * rb->channels], src, first * frame);
+    memcpy(rb->data, src + first * rb->channels, (n - first) * frame);
+
+    atomic_store_explicit(&rb->write, w + n, memory_order_release);
+    return n;
+}
+
+unsigned int rb_read(RingBuffer *rb, float *dst, unsigned int n) {
+    unsigned int r = atomic_load_explicit(&rb->read, memory_order_relaxed);
+    unsigned int w = atomic_load_explicit(&rb->write, memory_order_acquire);
+    unsigned int count = w - r;
+    if (n > count) n = count;
+
+    const size_t frame = rb->channels * sizeof(float);
+    unsigned int pos = r & rb->mask;
+    unsigned int first = rb->size - pos;
+    if (first > n) first = n;
+    memcpy(dst, &rb->data[pos * rb->channels], first * frame);
+    memcpy(dst + first * rb->channels, rb->data, (n - first) * frame);
+
+    atomic_store_explicit(&rb->read, r + n, memory_order_release);
+    return n;
+}
+
+unsigned int rb_skip(RingBuffer *rb, unsigned int n) {
+    unsigned int r = atomic_load_explicit(&rb->read, memory_order_relaxed);
+    unsigned int w = atomic_load_explicit(&rb->write, memory_order_acquire);
+    if (n > w - r) n = w - r;
+    atomic_store_explicit(&rb->read, r + n, memory_order_release);
+    return n;
+}
+
+void rb_discard(RingBuffer *rb) {
+    unsigned int w = atomic_load_explicit(&rb->write, memory_order_acquire);
+    atomic_store_explicit(&rb->read, w, memory_order_release);
+}
@@ -0,0 +1,46 @@
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+#include <stdatomic.h>
+
+// Single-producer/single-consumer ring buffer of interleaved float
+// frames. Positions and sizes count frames of 'channels' samples, so a
+// span never splits a frame. Read and write positions run freely and are
+// masked on access, so the fill level is always write - read. The
+// producer only stores 'write' and the consumer only stores 'read';
+// acquire/release ordering makes the sample data visible before the
+// position that publishes it.
+typedef struct RingBuffer {
+    float *data;
+    unsigned int size;        // capacity in frames (power of two)
+    unsigned int mask;        // size - 1
+    unsigned int channels;    // samples per frame
+    atomic_uint read;         // consumer position
+    atomic_uint write;        // producer position
+} RingBuffer;
+
+// Allocate a ring holding at least min_frames frames
+int rb_init(RingBuffer *rb, unsigned int min_frames, unsigned int channels);
+void rb_free(RingBuffer *rb);
+
+// Frames available to the consumer / free space for the producer. Other
+// threads may call them too, for a count within [0, size].
+unsigned int rb_count(RingBuffer *rb);
+unsigned int rb_space(RingBuffer *rb);
+
+// Producer side: contiguous writable span of *len frames, then publish
+// n frames of it
+float *rb_write_span(RingBuffer *rb, unsigned int *len);
+void rb_commit_write(RingBuffer *rb, unsigned int n);
+
+// Bulk copies of n frames, returning the number of frames transferred
+unsigned int rb_write(RingBuffer *rb, const float *src, unsigned int n);
+unsigned int rb_read(RingBuffer *rb, float *dst, unsigned int n);
+
+// Consumer side: drop up to n frames, returning how many were dropped
+unsigned int rb_skip(RingBuffer *rb, unsigned int n);
+
+// Consumer side: drop everything currently buffered
+void rb_discard(RingBuffer *rb);
+
+#endif // RINGBUF_H
@@ -0,0 +1,100 @@
+// cpu_set_t and pthread_setaffinity_np are GNU extensions
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rt.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#endif
+
+int rt_lock_memory(void) {
+#ifdef _WIN32
+    fprintf(stderr, "Warning: memory locking is not supported on Windows\n");
+    return 1;
+#else
+    // Locking future pages too makes every allocation past RLIMIT_MEMLOCK
+    // fail, Lua states included, so only do it when the limit can't be hit
+    struct rlimit limit;
+    int flags = MCL_CURRENT;
+    if (geteuid() == 0 ||
+        (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY)) {
+        flags |= MCL_FUTURE;
+    }
+    if (mlockall(flags) != 0) {
+        fprintf(stderr, "Warning: could not lock memory (%s); check RLIMIT_MEMLOCK\n",
+                strerror(errno));
+        return 1;
+    }
+    if (!(flags & MCL_FUTURE)) {
+        fprintf(stderr, "Warning: RLIMIT_MEMLOCK is limited, memory allocated from now on is not locked\n");
+    }
+    return 0;
+#endif
+}
+
+int rt_thread(int priority, int cpu, const char *name) {
+    int failed = 0;
+#ifdef _WIN32
+    if (priority > 0 && !SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+        fprintf(stderr, "Warning: could not raise the priority of %s\n", name);
+        failed = 1;
+    }
+    if (cpu >= 0 && (cpu >= (int)(sizeof(DWORD_PTR) * 8) ||
+                     !SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu))) {
+        fprintf(stderr, "Warning: could not pin %s to CPU %d\n", name, cpu);
+        failed = 1;
+    }
+#else
+    if (priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err != 0) {
+            fprintf(stderr, "Warning: could not give %s real-time priority (%s), it runs at normal priority\n",
+                    name, strerror(err));
+            failed = 1;
+        }
+    }
+    if (cpu >= 0) {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0) {
+            fprintf(stderr, "Warning: could not pin %s to CPU %d (%s)\n", name, cpu, strerror(err));
+            failed = 1;
+        }
+#else
+        fprintf(stderr, "Warning: CPU pinning is not supported here, %s runs on any CPU\n", name);
+        failed = 1;
+#endif
+    }
+#endif
+    return failed;
+}
+
+int rt_parse_cpus(const char *list, int *cpus, int max) {
+    int count = 0;
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long cpu = strtol(p, &end, 10);
+        if (end == p || cpu < 0 || cpu > 1023 || count == max || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        cpus[count++] = (int)cpu;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
@@ -0,0 +1,25 @@
+#ifndef RT_H
+#define RT_H
+
+// Real-time scheduling for the audio threads. Everything here is best
+// effort: when the system doesn't allow it (no CAP_SYS_NICE, a low
+// RLIMIT_RTPRIO or RLIMIT_MEMLOCK, or an unsupported platform) a warning
+// is printed and the threads keep running as before.
+
+// Priority of the producer under --realtime; track threads run one below
+#define RT_PRIORITY 70
+
+// Lock the process's memory so the audio path never waits on a page
+// fault; 0 on success
+int rt_lock_memory(void);
+
+// Give the calling thread SCHED_FIFO priority (1-99, 0 leaves it alone)
+// and pin it to cpu (-1 = any). name identifies the thread in warnings.
+// 0 if everything asked for was applied.
+int rt_thread(int priority, int cpu, const char *name);
+
+// Parse a comma separated list of CPU numbers into cpus (at most max);
+// returns how many, or -1 if the list is malformed
+int rt_parse_cpus(const char *list, int *cpus, int max);
+
+#endif // RT_H
@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <sndfile.h>
+#include "sample_cache.h"
+#include "thread.h"
+
+enum {
+    SLOT_EMPTY = 0,
+    SLOT_QUEUED,      // waiting for the loader
+    SLOT_LOADING,     // being decoded
+    SLOT_READY,       // data may be read
+    SLOT_EVICTING,    // draining readers before the data is freed
+    SLOT_EVICTED,     // freed, reloaded on next use
+    SLOT_FAILED
+};
+
+typedef struct SampleSlot {
+    char *path;
+    float *data;
+    long frames;
+    double sample_rate;
+    size_t bytes;
+    atomic_int state;
+    atomic_int users;          // readers currently inside sample_cache_read
+    atomic_uint last_used;     // LRU stamp
+} SampleSlot;
+
+static SampleSlot slots[SAMPLE_CACHE_SLOTS];
+static atomic_int slot_count;
+static atomic_uint lru_clock;
+static size_t cache_bytes;
+static size_t cache_max_bytes;
+static int cache_async;
+static int cache_initialized;
+
+// Protects slot allocation, cache_bytes and the loader queue
+static Mutex cache_lock;
+static Cond cache_wake;       // work for the loader
+static Cond cache_done;       // a load finished
+static Thread loader_thread;
+static int loader_running;
+
+// Drop least recently used samples until bytes more fit under the cap.
+// Called with cache_lock held.
+static void cache_evict(size_t bytes, int keep) {
+    while (cache_bytes + bytes > cache_max_bytes) {
+        int victim = -1;
+        unsigned int oldest = 0;
+        int count = atomic_load(&slot_count);
+        for (int i = 0; i < count; i++) {
+            if (i == keep || atomic_load(&slots[i].state) != SLOT_READY) continue;
+            unsigned int used = atomic_load(&slots[i].last_used);
+            if (victim < 0 || (int)(used - oldest) < 0) {
+                victim = i;
+                oldest = used;
+            }
+        }
+        if (victim < 0) {
+            return;
+        }
+
+        SampleSlot *slot = &slots[victim];
+        int expected = SLOT_READY;
+        if (!atomic_compare_exchange_strong(&slot->state, &expected, SLOT_EVICTING)) {
+            continue;
+        }
+        // Readers that saw READY before the switch finish their read first
+        while (atomic_load(&slot->users) > 0) {
+            thread_yield();
+        }
+        free(slot->data);
+        slot->data = NULL;
+        cache_bytes -= slot->bytes;
+        slot->bytes = 0;
+        atomic_store(&slot->state, SLOT_EVICTED);
+    }
+}
+
+// Decode a claimed (LOADING) slot. Called without cache_lock held.
+static void cache_decode(int handle) {
+    SampleSlot *slot = &slots[handle];
+    SF_INFO info = {0};
+    SNDFILE *file = sf_open(slot->path, SFM_READ, &info);
+    float *interleaved = NULL;
+    float *mono = NULL;
+
+    if (!file) {
+        fprintf(stderr, "Error loading sample %s: %s\n", slot->path, sf_strerror(NULL));
+        goto failed;
+    }
+
+    interleaved = (float *)malloc((size_t)info.frames * info.channels * sizeof(float));
+    mono = (float *)malloc((size_t)info.frames * sizeof(float));
+    if (!interleaved || !mono) {
+        fprintf(stderr, "Error loading sample %s: out of memory\n", slot->path);
+        goto failed;
+    }
+
+    sf_count_t frames = sf_readf_float(file, interleaved, info.frames);
+    sf_close(file);
+    file = NULL;
+
+    // Mix down to mono
+    for (sf_count_t i = 0; i < frames; i++) {
+        float sum = 0.0f;
+        for (int c = 0; c < info.channels; c++) {
+            sum += interleaved[i * info.channels + c];
+        }
+        mono[i] = sum / (float)info.channels;
+    }
+    free(interleaved);
+
+    size_t bytes = (size_t)frames * sizeof(float);
+    mutex_lock(&cache_lock);
+    cache_evict(bytes, handle);
+    if (cache_bytes + bytes > cache_max_bytes) {
+        fprintf(stderr, "Warning: sample cache over its %zu byte cap loading %s\n",
+                cache_max_bytes, slot->path);
+    }
+    cache_bytes += bytes;
+    slot->data = mono;
+    slot->frames = (long)frames;
+    slot->sample_rate = (double)info.samplerate;
+    slot->bytes = bytes;
+    atomic_store(&slot->last_used, atomic_fetch_add(&lru_clock, 1));
+    atomic_store(&slot->state, SLOT_READY);
+    cond_broadcast(&cache_done);
+    mutex_unlock(&cache_lock);
+    return;
+
+failed:
+    if (file) sf_close(file);
+    free(interleaved);
+    free(mono);
+    mutex_lock(&cache_lock);
+    atomic_store(&slot->state, SLOT_FAILED);
+    cond_broadcast(&cache_done);
+    mutex_unlock(&cache_lock);
+}
+
+// Move a slot from QUEUED/EVICTED to LOADING; 0 if someone else has it
+static int cache_claim(int handle) {
+    int expected = SLOT_QUEUED;
+    if (atomic_compare_exchange_strong(&slots[handle].state, &expected, SLOT_LOADING)) {
+        return 1;
+    }
+    expected = SLOT_EVICTED;
+    return atomic_compare_exchange_strong(&slots[handle].state, &expected, SLOT_LOADING);
+}
+
+static void *loader_func(void *arg) {
+    (void)arg;
+    mutex_lock(&cache_lock);
+    while (loader_running) {
+        int found = -1;
+        int count = atomic_load(&slot_count);
+        for (int i = 0; i < count; i++) {
+            if (atomic_load(&slots[i].state) == SLOT_QUEUED && cache_claim(i)) {
+                found = i;
+                break;
+            }
+        }
+        if (found < 0) {
+            cond_wait(&cache_wake, &cache_lock);
+            continue;
+        }
+        mutex_unlock(&cache_lock);
+        cache_decode(found);
+        mutex_lock(&cache_lock);
+    }
+    mutex_unlock(&cache_lock);
+    return NULL;
+}
+
+int sample_cache_init(size_t max_bytes, int async) {
+    if (cache_initialized) {
+        return 0;
+    }
+    mutex_init(&cache_lock);
+    cond_init(&cache_wake);
+    cond_init(&cache_done);
+    cache_max_bytes = max_bytes;
+    cache_async = async;
+    cache_bytes = 0;
+    atomic_store(&slot_count, 0);
+
+    if (async) {
+        loader_running = 1;
+        if (thread_start(&loader_thread, loader_func, NULL) != 0) {
+            fprintf(stderr, "Warning: no sample loader thread, loading synchronously\n");
+            loader_running = 0;
+            cache_async = 0;
+        }
+    }
+    cache_initialized = 1;
+    return 0;
+}
+
+void sample_cache_shutdown(void) {
+    if (!cache_initialized) {
+        return;
+    }
+    if (loader_running) {
+        mutex_lock(&cache_lock);
+        loader_running = 0;
+        cond_signal(&cache_wake);
+        mutex_unlock(&cache_lock);
+        thread_join(loader_thread);
+    }
+
+    int count = atomic_load(&slot_count);
+    for (int i = 0; i < count; i++) {
+        free(slots[i].data);
+        free(slots[i].path);
+        slots[i].data = NULL;
+        slots[i].path = NULL;
+        atomic_store(&slots[i].state, SLOT_EMPTY);
+    }
+    atomic_store(&slot_count, 0);
+    cond_destroy(&cache_wake);
+    cond_destroy(&cache_done);
+    mutex_destroy(&cache_lock);
+    cache_initialized = 0;
+}
+
+int sample_cache_intern(const char *path) {
+    if (!cache_initialized) {
+        return -1;
+    }
+    mutex_lock(&cache_lock);
+    int count = atomic_load(&slot_count);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(slots[i].path, path) == 0) {
+            mutex_unlock(&cache_lock);
+            return i;
+        }
+    }
+    if (count == SAMPLE_CACHE_SLOTS) {
+        mutex_unlock(&cache_lock);
+        fprintf(stderr, "Error: sample cache is full, cannot load %s\n", path);
+        return -1;
+    }
+
+    SampleSlot *slot = &slots[count];
+    size_t len = strlen(path) + 1;
+    slot->path = (char *)malloc(len);
+    if (!slot->path) {
+        mutex_unlock(&cache_lock);
+        return -1;
+    }
+    memcpy(slot->path, path, len);
+    slot->data = NULL;
+    slot->bytes = 0;
+    atomic_store(&slot->users, 0);
+    atomic_store(&slot->state, SLOT_QUEUED);
+    // Publish the slot only once it is set up
+    atomic_store(&slot_count, count + 1);
+    cond_signal(&cache_wake);
+    mutex_unlock(&cache_lock);
+
+    if (!cache_async) {
+        sample_cache_load(count);
+    }
+    return count;
+}
+
+int sample_cache_load(int handle) {
+    if (handle < 0 || handle >= atomic_load(&slot_count)) {
+        return 1;
+    }
+    if (cache_claim(handle)) {
+        cache_decode(handle);
+    } else {
+        // Being decoded by the loader: wait for it
+        mutex_lock(&cache_lock);
+        while (atomic_load(&slots[handle].state) == SLOT_LOADING) {
+            cond_wait(&cache_done, &cache_lock);
+        }
+        mutex_unlock(&cache_lock);
+    }
+    return atomic_load(&slots[handle].state) == SLOT_READY ? 0 : 1;
+}
+
+// 4-point Hermite interpolation between y1 and y2
+static double cubic(double y0, double y1, double y2, double y3, double x) {
+    double c1 = 0.5 * (y2 - y0);
+    double c2 = y0 - 2.5 * y1 + 2.0 * y2 - 0.5 * y3;
+    double c3 = 0.5 * (y3 - y0) + 1.5 * (y1 - y2);
+    return ((c3 * x + c2) * x + c1) * x + y1;
+}
+
+static double frame_at(const SampleSlot *slot, long i) {
+    return (i >= 0 && i < slot->frames) ? slot->data[i] : 0.0;
+}
+
+double sample_cache_read(int handle, double pos, int interp) {
+    if (handle < 0 || handle >= atomic_load_explicit(&slot_count, memory_order_acquire)) {
+        return 0.0;
+    }
+    SampleSlot *slot = &slots[handle];
+    double value = 0.0;
+
+    atomic_fetch_add(&slot->users, 1);
+    int state = atomic_load(&slot->state);
+    if (state == SLOT_READY) {
+        double x = pos * slot->sample_rate;
+        if (x >= 0.0 && x < (double)slot->frames) {
+            long i = (long)x;
+            double frac = x - (double)i;
+            switch (interp) {
+            case SAMPLE_INTERP_NONE:
+                value = slot->data[i];
+                break;
+            case SAMPLE_INTERP_CUBIC:
+                value = cubic(frame_at(slot, i - 1), slot->data[i],
+                              frame_at(slot, i + 1), frame_at(slot, i + 2), frac);
+                break;
+            default:
+                value = slot->data[i] + (frame_at(slot, i + 1) - slot->data[i]) * frac;
+                break;
+            }
+        }
+        atomic_store_explicit(&slot->last_used, atomic_load_explicit(&lru_clock, memory_order_relaxed),
+                              memory_order_relaxed);
+    }
+    atomic_fetch_sub(&slot->users, 1);
+
+    if (state == SLOT_EVICTED && cache_async) {
+        // Dropped by the LRU: queue it again
+        int expected = SLOT_EVICTED;
+        if (atomic_compare_exchange_strong(&slot->state, &expected, SLOT_QUEUED)) {
+            mutex_lock(&cache_lock);
+            cond_signal(&cache_wake);
+            mutex_unlock(&cache_lock);
+        }
+    } else if (state == SLOT_EVICTED) {
+        sample_cache_load(handle);
+    }
+    return value;
+}
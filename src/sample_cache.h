@@ -0,0 +1,33 @@
+#ifndef SAMPLE_CACHE_H
+#define SAMPLE_CACHE_H
+
+#include <stddef.h>
+
+// Decoded audio files shared by every script, addressed by small integer
+// handles. Files are decoded once with libsndfile into mono float arrays,
+// either on a loader thread (live mode) or synchronously (offline mode),
+// and the least recently used ones are dropped above a memory cap.
+
+#define SAMPLE_CACHE_SLOTS 256
+
+enum {
+    SAMPLE_INTERP_NONE = 0,
+    SAMPLE_INTERP_LINEAR,
+    SAMPLE_INTERP_CUBIC
+};
+
+// Start the cache. With async set, misses are decoded on a loader thread
+// and read as silence until ready; otherwise they are decoded on the spot.
+int sample_cache_init(size_t max_bytes, int async);
+void sample_cache_shutdown(void);
+
+// Handle for path, queueing it for decoding if needed (-1 when full)
+int sample_cache_intern(const char *path);
+
+// Decode handle now if it isn't loaded yet. Returns 0 once it is ready.
+int sample_cache_load(int handle);
+
+// Value of handle at pos seconds, 0 outside the file or while loading
+double sample_cache_read(int handle, double pos, int interp);
+
+#endif // SAMPLE_CACHE_H
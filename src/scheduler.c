@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+#include "scheduler.h"
+
+// Room for a busy pattern set before the heap ever grows
+#define SCHEDULER_INITIAL 64
+
+static int event_before(const Event *a, const Event *b) {
+    return a->frame < b->frame || (a->frame == b->frame && a->seq < b->seq);
+}
+
+static void swap_events(Event *a, Event *b) {
+    Event tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static void sift_up(Event *events, int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!event_before(&events[i], &events[parent])) {
+            break;
+        }
+        swap_events(&events[i], &events[parent]);
+        i = parent;
+    }
+}
+
+static void sift_down(Event *events, int count, int i) {
+    for (;;) {
+        int first = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < count && event_before(&events[left], &events[first])) first = left;
+        if (right < count && event_before(&events[right], &events[first])) first = right;
+        if (first == i) {
+            break;
+        }
+        swap_events(&events[i], &events[first]);
+        i = first;
+    }
+}
+
+void scheduler_init(Scheduler *sched) {
+    memset(sched, 0, sizeof(*sched));
+    sched->next_id = 1;
+}
+
+void scheduler_free(Scheduler *sched) {
+    free(sched->events);
+    scheduler_init(sched);
+}
+
+int scheduler_push(Scheduler *sched, Event *event) {
+    if (sched->count == sched->capacity) {
+        int capacity = sched->capacity ? sched->capacity * 2 : SCHEDULER_INITIAL;
+        Event *events = (Event *)realloc(sched->events, (size_t)capacity * sizeof(Event));
+        if (!events) {
+            return 1;
+        }
+        sched->events = events;
+        sched->capacity = capacity;
+    }
+    if (event->id == 0) {
+        event->id = sched->next_id++;
+    }
+    event->seq = sched->seq++;
+    sched->events[sched->count] = *event;
+    sift_up(sched->events, sched->count++);
+    return 0;
+}
+
+const Event *scheduler_peek(const Scheduler *sched) {
+    return sched->count > 0 ? &sched->events[0] : NULL;
+}
+
+// Take out the event at index i, keeping the heap ordered
+static void remove_at(Scheduler *sched, int i, Event *out) {
+    *out = sched->events[i];
+    sched->count--;
+    if (i == sched->count) {
+        return;
+    }
+    sched->events[i] = sched->events[sched->count];
+    sift_up(sched->events, i);
+    sift_down(sched->events, sched->count, i);
+}
+
+int scheduler_pop(Scheduler *sched, Event *out) {
+    if (sched->count == 0) {
+        return 0;
+    }
+    remove_at(sched, 0, out);
+    return 1;
+}
+
+int scheduler_remove(Scheduler *sched, int id, Event *out) {
+    for (int i = 0; i < sched->count; i++) {
+        if (sched->events[i].id == id) {
+            remove_at(sched, i, out);
+            return 1;
+        }
+    }
+    return 0;
+}
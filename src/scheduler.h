@@ -0,0 +1,48 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+// Events of one script, in a binary min-heap keyed by the sample index
+// they fire at, so rendering only has to look at the top to know how far
+// it can go before calling Lua. Events firing on the same sample come out
+// in the order they were scheduled. The heap only stores what the script
+// side needs to call back (registry refs); it never touches Lua itself.
+
+typedef struct Event {
+    unsigned long long frame;  // sample the event fires at next
+    unsigned long long seq;    // scheduling order, breaks ties
+    // Periodic events fire at origin + count * period samples; the period
+    // is fractional so long runs of steps don't drift
+    double origin;
+    double period;             // 0 for one-shot events
+    unsigned long long count;  // times fired so far
+    int id;
+    int fn;                    // registry ref of the callback
+    int steps;                 // pattern: registry ref of the steps, or LUA_NOREF
+    int length;                // pattern: number of steps
+} Event;
+
+typedef struct Scheduler {
+    Event *events;
+    int count;
+    int capacity;
+    int next_id;
+    int firing;                // id of the event being called back, 0 once cancelled
+    unsigned long long seq;
+} Scheduler;
+
+void scheduler_init(Scheduler *sched);
+void scheduler_free(Scheduler *sched);
+
+// Add an event; it gets the next id if it has none. 0 on success.
+int scheduler_push(Scheduler *sched, Event *event);
+
+// Earliest event, or NULL if there is none
+const Event *scheduler_peek(const Scheduler *sched);
+
+// Remove the earliest event into out; 0 if there was none
+int scheduler_pop(Scheduler *sched, Event *out);
+
+// Remove the event with this id into out; 0 if there is none
+int scheduler_remove(Scheduler *sched, int id, Event *out);
+
+#endif // SCHEDULER_H
@@ -0,0 +1,643 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+#include "script.h"
+#include "audio.h"
+#include "stats.h"
+
+// A scheduled collection cycle starts once memory reaches this percentage
+// of what the last cycle left, like the collector's own pause
+#define GC_PAUSE 200
+// Kilobytes of allocation paid for by each incremental step
+#define GC_STEP_KB 16
+// Lua instructions between two watchdog checks
+#define WATCHDOG_COUNT 4096
+
+static size_t memory_limit;
+
+void script_set_memory_limit(size_t bytes) {
+    memory_limit = bytes;
+}
+
+static int script_panic(lua_State *L) {
+    fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(L, -1));
+    return 0;
+}
+
+Script *script_new(int sample_rate, int block_size, int channels) {
+    Script *script = (Script *)calloc(1, sizeof(Script));
+    if (!script) {
+        return NULL;
+    }
+    pool_init(&script->pool, memory_limit);
+    script->L = lua_newstate(pool_alloc, &script->pool);
+    if (!script->L) {
+        // 64-bit LuaJIT built without GC64 only runs on its own allocator
+        script->L = luaL_newstate();
+    } else {
+        lua_atpanic(script->L, script_panic);
+    }
+    if (!script->L) {
+        free(script);
+        return NULL;
+    }
+    script->sample_rate = sample_rate;
+    script->block_size = block_size;
+    script->channels = channels;
+    script->gain = 1.0f;
+    scheduler_init(&script->sched);
+    // Differs per run and per script until the script calls chip.seed
+    noise_seed(&script->noise, (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)script);
+
+    luaL_openlibs(script->L);
+    luaopen_audio(script->L, script);
+    lua_pop(script->L, 1);
+    return script;
+}
+
+ScriptSource *script_source_read(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Error loading script: cannot open %s\n", path);
+        return NULL;
+    }
+    size_t capacity = 4096, len = 0, got;
+    ScriptSource *source = (ScriptSource *)malloc(sizeof(ScriptSource) + capacity);
+    while (source && (got = fread(source->text + len, 1, capacity - len, file)) > 0) {
+        len += got;
+        if (len == capacity) {
+            capacity *= 2;
+            ScriptSource *grown = (ScriptSource *)realloc(source, sizeof(ScriptSource) + capacity);
+            if (!grown) {
+                free(source);
+            }
+            source = grown;
+        }
+    }
+    int error = ferror(file);
+    fclose(file);
+    if (!source || error) {
+        fprintf(stderr, "Error loading script: cannot read %s\n", path);
+        free(source);
+        return NULL;
+    }
+    atomic_init(&source->refs, 1);
+    source->len = len;
+    return source;
+}
+
+void script_source_retain(ScriptSource *source) {
+    atomic_fetch_add(&source->refs, 1);
+}
+
+void script_source_release(ScriptSource *source) {
+    if (source && atomic_fetch_sub(&source->refs, 1) == 1) {
+        free(source);
+    }
+}
+
+Script *script_open_source(const char *path, ScriptSource *source, int sample_rate,
+                           int block_size, int channels, double watchdog,
+                           unsigned long long frame) {
+    Script *script = script_new(sample_rate, block_size, channels);
+    if (!script) {
+        fprintf(stderr, "Failed to initialize Lua\n");
+        return NULL;
+    }
+    script_set_watchdog(script, watchdog);
+    script->frame = frame;
+    script->time = (double)frame / sample_rate;
+    if (script_load_source(script, path, source) != 0) {
+        script_free(script);
+        return NULL;
+    }
+    return script;
+}
+
+Script *script_open(const char *path, int sample_rate, int block_size, int channels,
+                    double watchdog, unsigned long long frame) {
+    ScriptSource *source = script_source_read(path);
+    if (!source) {
+        return NULL;
+    }
+    Script *script = script_open_source(path, source, sample_rate, block_size, channels,
+                                        watchdog, frame);
+    script_source_release(source);
+    return script;
+}
+
+// Compile a bytebeat expression with chip.expr, leaving it on the stack
+static int load_bytebeat(lua_State *L, const ScriptSource *source) {
+    lua_pushlstring(L, source->text, source->len);
+    lua_getglobal(L, "chip");
+    lua_getfield(L, -1, "expr");
+    lua_remove(L, -2);
+    lua_insert(L, -2);
+    return lua_pcall(L, 1, 1, 0);
+}
+
+static int has_suffix(const char *s, const char *suffix) {
+    size_t len = strlen(s), slen = strlen(suffix);
+    return len >= slen && strcmp(s + len - slen, suffix) == 0;
+}
+
+// Run a Lua chunk, leaving its first result on the stack
+static int load_lua(lua_State *L, const char *path, const ScriptSource *source) {
+    char name[260];
+    snprintf(name, sizeof(name), "@%s", path);
+    if (luaL_loadbuffer(L, source->text, source->len, name) != 0) {
+        return 1;
+    }
+    return lua_pcall(L, 0, 1, 0);
+}
+
+int script_load(Script *script, const char *path) {
+    ScriptSource *source = script_source_read(path);
+    if (!source) {
+        return 1;
+    }
+    int result = script_load_source(script, path, source);
+    script_source_release(source);
+    return result;
+}
+
+int script_load_source(Script *script, const char *path, ScriptSource *source) {
+    lua_State *L = script->L;
+
+    script_source_release(script->source);
+    script_source_retain(source);
+    script->source = source;
+
+    script->watchdog_end = script->watchdog > 0.0 ? stats_now() + script->watchdog : 0.0;
+    int failed = has_suffix(path, ".bb") ? load_bytebeat(L, source) != 0 : load_lua(L, path, source) != 0;
+    script->watchdog_end = 0.0;
+    script->aborted = 0;
+    if (failed) {
+        fprintf(stderr, "Error loading script: %s\n", lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return 1;
+    }
+    if (script_install(script) != 0) {
+        return 1;
+    }
+    snprintf(script->path, sizeof(script->path), "%s", path);
+    return 0;
+}
+
+// Detect which generator contract the value on top of the stack uses
+int script_install(Script *script) {
+    lua_State *L = script->L;
+    int block_mode;
+    int block_channels = 1;
+    Expr *expr = NULL;
+
+    if (lua_isuserdata(L, -1) && lua_getmetatable(L, -1)) {
+        // Bytebeat expression from chip.expr
+        luaL_getmetatable(L, "chip.expr");
+        int is_expr = lua_rawequal(L, -1, -2);
+        lua_pop(L, 2);
+        if (!is_expr) {
+            fprintf(stderr, "Script must return a function\n");
+            lua_pop(L, 1);
+            return 1;
+        }
+        expr = *(Expr **)lua_touserdata(L, -1);
+        block_mode = 0;
+        // Keep it alive whatever the script does with 'main'
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, "chip.main_expr");
+    } else if (lua_isfunction(L, -1)) {
+        // Per-sample contract: main(t)
+        block_mode = 0;
+    } else if (lua_istable(L, -1)) {
+        // Block contract: { block = main(t0, dt, n, out), channels = c }
+        lua_getfield(L, -1, "channels");
+        if (lua_isnumber(L, -1)) {
+            block_channels = (int)lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+        if (block_channels < 1) {
+            fprintf(stderr, "Script 'channels' must be at least 1\n");
+            lua_pop(L, 1);
+            return 1;
+        }
+        lua_getfield(L, -1, "block");
+        lua_remove(L, -2);
+        if (!lua_isfunction(L, -1)) {
+            fprintf(stderr, "Script table must have a 'block' function\n");
+            lua_pop(L, 1);
+            return 1;
+        }
+        block_mode = 1;
+    } else {
+        fprintf(stderr, "Script must return a function\n");
+        lua_pop(L, 1);
+        return 1;
+    }
+
+    // Preallocate the output table handed to block generators
+    if (block_mode && script->block_ref == 0) {
+        int size = script->block_size * block_channels;
+        lua_createtable(L, size, 0);
+        for (int i = 1; i <= size; i++) {
+            lua_pushnumber(L, 0.0);
+            lua_rawseti(L, -2, i);
+        }
+        script->block_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
+
+    // Under LuaJIT, block generators write straight into the output buffer
+    if (block_mode && script->ffi_ref == 0) {
+        lua_getfield(L, LUA_REGISTRYINDEX, "chip.ffi_block");
+        if (lua_isfunction(L, -1)) {
+            script->ffi_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+        } else {
+            lua_pop(L, 1);
+        }
+    }
+
+    // main can only write straight into the output if the layouts match
+    if (script->ffi_ref && block_mode && block_channels != script->channels) {
+        free(script->block_buf);
+        script->block_buf = (float *)malloc((size_t)script->block_size * block_channels * sizeof(float));
+        if (!script->block_buf) {
+            fprintf(stderr, "Failed to allocate the block buffer\n");
+            lua_pop(L, 1);
+            return 1;
+        }
+    }
+
+    lua_setglobal(L, "main");
+    script->block_mode = block_mode;
+    script->block_channels = block_channels;
+    script->expr = expr;
+    return 0;
+}
+
+// Count hook: raise an error in the running script once its block is over
+// budget. script_render sees 'aborted' and skips the rest of the block.
+static void watchdog_hook(lua_State *L, lua_Debug *ar) {
+    (void)ar;
+    lua_getfield(L, LUA_REGISTRYINDEX, "chip.script");
+    Script *script = (Script *)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (script && script->watchdog_end > 0.0 && stats_now() > script->watchdog_end) {
+        script->aborted = 1;
+        luaL_error(L, "watchdog: block took longer than %f s", script->watchdog);
+    }
+}
+
+void script_set_watchdog(Script *script, double seconds) {
+    script->watchdog = seconds > 0.0 ? seconds : 0.0;
+    if (script->watchdog > 0.0) {
+        lua_sethook(script->L, watchdog_hook, LUA_MASKCOUNT, WATCHDOG_COUNT);
+    } else {
+        lua_sethook(script->L, NULL, 0, 0);
+    }
+}
+
+// Count an aborted block against the script, muting it after too many
+static void watchdog_strike(Script *script) {
+    if (!script->aborted) {
+        script->strikes = 0;
+        return;
+    }
+    script->aborted = 0;
+    if (++script->strikes >= SCRIPT_WATCHDOG_STRIKES) {
+        script->muted = 1;
+        fprintf(stderr, "Watchdog: %s ran over its %.0f ms budget %d blocks in a row, muted until reloaded\n",
+                script->path, script->watchdog * 1000.0, script->strikes);
+    } else {
+        fprintf(stderr, "Watchdog: %s ran over its %.0f ms budget, block aborted\n",
+                script->path, script->watchdog * 1000.0);
+    }
+}
+
+static float to_sample(double v, float gain) {
+    if (v > 1.0) v = 1.0;
+    if (v < -1.0) v = -1.0;
+    return (float)(v * gain);
+}
+
+// Channels missing from a frame repeat the ones main did produce
+static void fill_channels(float *frame, int from, int channels) {
+    for (int c = from; c < channels; c++) {
+        frame[c] = frame[c % from];
+    }
+}
+
+// Render n frames with no event in between. Time is derived from the
+// integer frame count, so it never drifts however long the set runs.
+static void render_span(Script *script, float *out, int n, float gain) {
+    lua_State *L = script->L;
+    const double rate = (double)script->sample_rate;
+    const double dt = 1.0 / rate;
+    const unsigned long long frame = script->frame;
+    const double t0 = (double)frame / rate;
+    const int ch = script->channels;
+    const int bc = script->block_channels;
+    const int used = bc < ch ? bc : ch;
+
+    script->time = t0;
+    if (script->expr) {
+        // Bytebeat: evaluated in C, then spread over the channels from the
+        // back so the mono samples are read before they are overwritten
+        expr_eval(script->expr, out, n, frame, script->sample_rate);
+        for (int i = n - 1; i >= 0; i--) {
+            float v = to_sample(out[i], gain);
+            for (int c = ch - 1; c >= 0; c--) {
+                out[i * ch + c] = v;
+            }
+        }
+        script->frame = frame + (unsigned long long)n;
+        script->time = (double)script->frame / rate;
+        return;
+    }
+
+    lua_getglobal(L, "main");
+    if (script->muted || !lua_isfunction(L, -1)) {
+        lua_pop(L, 1);
+        memset(out, 0, (size_t)n * ch * sizeof(float));
+    } else if (script->block_mode && script->ffi_ref) {
+        // LuaJIT: main gets a float* view of the buffer (indexed 1..n*bc)
+        // and writes the samples in place, with no per-sample Lua API calls
+        float *buf = script->block_buf ? script->block_buf : out;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, script->ffi_ref);
+        lua_insert(L, -2);
+        lua_pushnumber(L, t0);
+        lua_pushnumber(L, dt);
+        lua_pushinteger(L, n);
+        lua_pushlightuserdata(L, buf);
+        if (lua_pcall(L, 5, 0, 0) != 0) {
+            // error -> silence
+            lua_pop(L, 1);
+            memset(out, 0, (size_t)n * ch * sizeof(float));
+        } else if (buf == out) {
+            for (int i = 0; i < n * ch; i++) {
+                out[i] = to_sample(out[i], gain);
+            }
+        } else {
+            for (int i = 0; i < n; i++) {
+                float *f = out + i * ch;
+                for (int c = 0; c < used; c++) {
+                    f[c] = to_sample(buf[i * bc + c], gain);
+                }
+                fill_channels(f, used, ch);
+            }
+        }
+    } else if (script->block_mode) {
+        // One call for the whole block
+        lua_pushnumber(L, t0);
+        lua_pushnumber(L, dt);
+        lua_pushinteger(L, n);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, script->block_ref);
+        if (lua_pcall(L, 4, 0, 0) != 0) {
+            // error -> silence
+            lua_pop(L, 1);
+            memset(out, 0, (size_t)n * ch * sizeof(float));
+        } else {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, script->block_ref);
+            for (int i = 0; i < n; i++) {
+                float *f = out + i * ch;
+                for (int c = 0; c < used; c++) {
+                    lua_rawgeti(L, -1, i * bc + c + 1);
+                    f[c] = lua_isnumber(L, -1) ? to_sample(lua_tonumber(L, -1), gain) : 0.0f;
+                    lua_pop(L, 1);
+                }
+                fill_channels(f, used, ch);
+            }
+            lua_pop(L, 1);
+        }
+    } else {
+        // Per-frame calls, reusing the function pushed above; main returns
+        // one value per channel
+        const int base = lua_gettop(L);
+        for (int i = 0; i < n; i++) {
+            float *f = out + i * ch;
+            if (script->aborted) {
+                memset(f, 0, (size_t)(n - i) * ch * sizeof(float));
+                break;
+            }
+            script->time = (double)(frame + (unsigned long long)i) / rate;
+            lua_pushvalue(L, -1);
+            lua_pushnumber(L, script->time);
+            if (lua_pcall(L, 1, LUA_MULTRET, 0) != 0) {
+                // error -> silence
+                memset(f, 0, (size_t)ch * sizeof(float));
+                lua_pop(L, 1);
+                continue;
+            }
+            int got = lua_gettop(L) - base;
+            if (got > ch) got = ch;
+            for (int c = 0; c < got; c++) {
+                lua_Number v = lua_tonumber(L, base + 1 + c);
+                f[c] = lua_isnumber(L, base + 1 + c) ? to_sample(v, gain) : 0.0f;
+            }
+            if (got > 0) {
+                fill_channels(f, got, ch);
+            } else {
+                memset(f, 0, (size_t)ch * sizeof(float));
+            }
+            lua_settop(L, base);
+        }
+        lua_pop(L, 1);
+    }
+
+    script->frame = frame + (unsigned long long)n;
+    script->time = (double)script->frame / rate;
+}
+
+static unsigned long long event_frame(const Event *event) {
+    double frame = event->origin + (double)event->count * event->period;
+    return frame > 0.0 ? (unsigned long long)(frame + 0.5) : 0;
+}
+
+static void release_event(lua_State *L, const Event *event) {
+    luaL_unref(L, LUA_REGISTRYINDEX, event->fn);
+    luaL_unref(L, LUA_REGISTRYINDEX, event->steps);
+}
+
+int script_schedule(Script *script, double origin, double period, int fn, int steps, int length) {
+    Event event;
+    memset(&event, 0, sizeof(event));
+    event.origin = origin;
+    // At most one firing per sample
+    event.period = period > 0.0 && period < 1.0 ? 1.0 : period;
+    event.fn = fn;
+    event.steps = steps;
+    event.length = length;
+    event.frame = event_frame(&event);
+    if (scheduler_push(&script->sched, &event) != 0) {
+        release_event(script->L, &event);
+        return 0;
+    }
+    return event.id;
+}
+
+int script_cancel(Script *script, int id) {
+    Event event;
+    if (scheduler_remove(&script->sched, id, &event)) {
+        release_event(script->L, &event);
+        return 1;
+    }
+    // An event cancelling itself from its own callback
+    if (id != 0 && script->sched.firing == id) {
+        script->sched.firing = 0;
+        return 1;
+    }
+    return 0;
+}
+
+// Push the pattern step for the event; 0 (and nothing pushed) for a rest.
+// Steps are a string, where '.', '-', '_' and spaces rest and any other
+// character is passed as itself, or a table where false and 0 rest.
+static int push_step(lua_State *L, const Event *event) {
+    int step = (int)(event->count % (unsigned long long)event->length);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, event->steps);
+    if (lua_type(L, -1) == LUA_TSTRING) {
+        char c = lua_tostring(L, -1)[step];
+        lua_pop(L, 1);
+        if (c == '.' || c == '-' || c == '_' || c == ' ') {
+            return 0;
+        }
+        lua_pushlstring(L, &c, 1);
+    } else {
+        lua_rawgeti(L, -1, step + 1);
+        lua_remove(L, -2);
+        if (lua_isnil(L, -1) || (lua_isboolean(L, -1) && !lua_toboolean(L, -1)) ||
+            (lua_isnumber(L, -1) && lua_tonumber(L, -1) == 0.0)) {
+            lua_pop(L, 1);
+            return 0;
+        }
+    }
+    lua_pushinteger(L, step + 1);
+    return 1;
+}
+
+// Call back every event due at the current frame: fn(t) for at and every,
+// fn(t, value, step) for the pattern steps that aren't rests. Periodic
+// events missed because the script jumped ahead (a reload or a late
+// track) are moved to their next time instead of firing all at once.
+static void fire_events(Script *script) {
+    lua_State *L = script->L;
+    const unsigned long long now = script->frame;
+    const Event *top;
+    Event event;
+
+    while (!script->aborted && (top = scheduler_peek(&script->sched)) && top->frame <= now) {
+        scheduler_pop(&script->sched, &event);
+        if (event.period > 0.0 && event.frame < now) {
+            event.count = (unsigned long long)ceil(((double)now - event.origin) / event.period);
+            event.frame = event_frame(&event);
+            if (event.frame < now) {
+                event.count++;
+                event.frame = event_frame(&event);
+            }
+            scheduler_push(&script->sched, &event);
+            continue;
+        }
+
+        script->time = (double)now / script->sample_rate;
+        lua_rawgeti(L, LUA_REGISTRYINDEX, event.fn);
+        lua_pushnumber(L, script->time);
+        int nargs = 1;
+        if (event.steps != LUA_NOREF) {
+            nargs = push_step(L, &event) ? 3 : 0;
+        }
+        script->sched.firing = event.id;
+        if (nargs == 0) {
+            lua_pop(L, 2);
+        } else if (lua_pcall(L, nargs, 0, 0) != 0) {
+            lua_pop(L, 1);
+        }
+
+        if (event.period > 0.0 && script->sched.firing == event.id) {
+            event.count++;
+            event.frame = event_frame(&event);
+            if (scheduler_push(&script->sched, &event) != 0) {
+                release_event(L, &event);
+            }
+        } else {
+            release_event(L, &event);
+        }
+        script->sched.firing = 0;
+    }
+}
+
+void script_render(Script *script, float *out, int n, float gain) {
+    const int ch = script->channels;
+    script->watchdog_end = script->watchdog > 0.0 ? stats_now() + script->watchdog : 0.0;
+    int done = 0;
+    while (done < n) {
+        int len = n - done;
+        if (!script->muted && !script->hold_events) {
+            fire_events(script);
+            if (script->aborted) {
+                // The watchdog stopped an event: the rest of the block is
+                // silence, and the events still due wait for the next one
+                memset(out + (size_t)done * ch, 0, (size_t)(n - done) * ch * sizeof(float));
+                script->frame += (unsigned long long)(n - done);
+                script->time = (double)script->frame / script->sample_rate;
+                break;
+            }
+            // Always advance, even past an event that is somehow still due
+            const Event *next = scheduler_peek(&script->sched);
+            if (next && next->frame < script->frame + (unsigned long long)len) {
+                len = next->frame > script->frame ? (int)(next->frame - script->frame) : 1;
+            }
+        }
+        render_span(script, out + (size_t)done * ch, len, gain);
+        done += len;
+    }
+    script->watchdog_end = 0.0;
+    watchdog_strike(script);
+}
+
+void script_gc_pause(Script *script) {
+    lua_gc(script->L, LUA_GCSTOP, 0);
+    if (script->gc_floor_kb == 0) {
+        script->gc_floor_kb = lua_gc(script->L, LUA_GCCOUNT, 0);
+    }
+}
+
+double script_collect(Script *script, double budget) {
+    lua_State *L = script->L;
+    if (!script->gc_active) {
+        size_t kb = (size_t)lua_gc(L, LUA_GCCOUNT, 0);
+        int near_limit = script->pool.limit && kb * 1024 > script->pool.limit / 4 * 3;
+        if (kb * 100 < (size_t)script->gc_floor_kb * GC_PAUSE && !near_limit) {
+            return 0.0;
+        }
+        script->gc_active = 1;
+    }
+
+    double start = stats_now();
+    do {
+        if (lua_gc(L, LUA_GCSTEP, GC_STEP_KB)) {
+            script->gc_active = 0;
+            script->gc_floor_kb = lua_gc(L, LUA_GCCOUNT, 0);
+            break;
+        }
+    } while (stats_now() - start < budget);
+    // Stepping re-arms the automatic collector
+    lua_gc(L, LUA_GCSTOP, 0);
+    return stats_now() - start;
+}
+
+void script_free(Script *script) {
+    if (!script) {
+        return;
+    }
+    lua_close(script->L);
+    pool_destroy(&script->pool);
+    scheduler_free(&script->sched);
+    free(script->block_buf);
+    script_source_release(script->source);
+    free(script);
+}
@@ -0,0 +1,131 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <lua.h>
+#include "noise.h"
+#include "pool.h"
+#include "expr.h"
+#include "scheduler.h"
+
+// Text of a script file as it was read, shared by reference: a Script
+// keeps the text it was compiled from, so pure workers compile exactly
+// the version that is playing even if the file has changed since
+typedef struct ScriptSource {
+    atomic_int refs;
+    size_t len;
+    char text[];
+} ScriptSource;
+
+// Read the file at path (one reference); NULL with the error printed
+ScriptSource *script_source_read(const char *path);
+void script_source_retain(ScriptSource *source);
+// Drop a reference, freeing the text with the last one (NULL is ignored)
+void script_source_release(ScriptSource *source);
+
+// A loaded script: its own lua_State with the chip library, the generator
+// the script returned, and the position it renders from. A Script is only
+// used by one thread at a time, so scripts can be compiled on one thread
+// and rendered on another, or render side by side.
+typedef struct Script {
+    lua_State *L;
+    char path[256];
+    ScriptSource *source;     // text the script was compiled from
+    int sample_rate;
+    int block_size;           // most frames rendered in one call
+    int channels;             // interleaved channels per output frame
+    unsigned long long frame; // index of the next sample to render
+    double time;              // frame / sample_rate, seen by chip.* functions
+    float gain;               // level the script is mixed at, set by chip.gain
+    Noise noise;              // rnd* and the noise fills, reseeded by chip.seed
+    Pool pool;                // allocator of L
+    Scheduler sched;          // chip.at / every / pattern events
+    int hold_events;          // render without firing events (reload warm-up)
+    int pure;                 // declared with chip.pure(): main depends on t alone
+    int gc_active;            // a scheduled collection cycle is under way
+    int gc_floor_kb;          // memory in use after the last cycle
+    // Generator contract
+    int block_mode;           // 1 if main is main(t0, dt, n, out)
+    int block_channels;       // channels per frame main writes to out
+    int block_ref;            // registry ref to the block output table
+    int ffi_ref;              // LuaJIT only: registry ref to the FFI block dispatcher
+    float *block_buf;         // LuaJIT only: out for main when its channels differ
+    Expr *expr;               // bytebeat main, rendered in C without calling Lua
+    // Watchdog: a block still running past its budget is aborted
+    double watchdog;          // seconds a block may take (0 = no limit)
+    double watchdog_end;      // stats_now() at which the current block is aborted
+    int aborted;              // the watchdog stopped the current block
+    int strikes;              // blocks aborted in a row
+    int muted;                // silenced by the watchdog until reloaded
+} Script;
+
+// Cap on the memory of each script's lua_State created from now on, in
+// bytes (0 = none). Allocations past it raise a Lua memory error.
+void script_set_memory_limit(size_t bytes);
+
+// Fresh lua_State with the standard libraries and the chip table
+Script *script_new(int sample_rate, int block_size, int channels);
+
+// script_new + script_set_watchdog + script_load, so the watchdog also
+// covers the script's top-level code, which runs at 'frame' (the live
+// position on a reload, so chip.at and friends see the current time);
+// NULL (with the error printed) on failure
+Script *script_open(const char *path, int sample_rate, int block_size, int channels,
+                    double watchdog, unsigned long long frame);
+
+// script_open from source text already read from path (path names the
+// chunk and picks the language by its extension)
+Script *script_open_source(const char *path, ScriptSource *source, int sample_rate,
+                           int block_size, int channels, double watchdog,
+                           unsigned long long frame);
+
+// Run a script file and install the generator it returns as 'main'.
+// The script returns either main(t) (one frame per call, returning one
+// value per channel), a table { block = main(t0, dt, n, out), channels = c }
+// that fills out[1..n*c] with n interleaved frames in one call (c defaults
+// to 1), or a bytebeat expression from chip.expr. Generators with fewer
+// channels than the output are repeated across the remaining channels, so
+// mono scripts play on every channel. A .bb file holds just an expression.
+// With a watchdog set, top-level code running over its budget fails the load.
+int script_load(Script *script, const char *path);
+
+// script_load from source text already read from path
+int script_load_source(Script *script, const char *path, ScriptSource *source);
+
+// Install the generator on top of the stack (popped) as 'main'
+int script_install(Script *script);
+
+// Render n frames (n <= block_size) starting at script->frame into out,
+// interleaved, advancing it. Samples are clamped to [-1, 1] and then
+// scaled by gain. The block is split at scheduled events, which are
+// called back right before the sample they are due on is rendered.
+void script_render(Script *script, float *out, int n, float gain);
+
+// Garbage collection for real-time rendering. script_gc_pause stops the
+// automatic collector, so it never runs inside script_render; the caller
+// then calls script_collect between blocks, which runs bounded incremental
+// steps for about 'budget' seconds (at least one step once a cycle is due)
+// and returns the seconds it spent.
+void script_gc_pause(Script *script);
+double script_collect(Script *script, double budget);
+
+// Abort any block of the script that runs longer than 'seconds' (0 = no
+// limit), playing silence for the rest of it. A script aborted on
+// SCRIPT_WATCHDOG_STRIKES blocks in a row stays silent until it is
+// replaced. Lua code compiled by LuaJIT's JIT is not interrupted.
+#define SCRIPT_WATCHDOG_STRIKES 3
+void script_set_watchdog(Script *script, double seconds);
+
+// Schedule fn (a registry ref, owned by the event from now on) at sample
+// 'origin' and, for period > 0, every 'period' samples after it. steps and
+// length make it a pattern step sequencer (steps = LUA_NOREF otherwise).
+// Returns the event id, or 0 if it could not be added.
+int script_schedule(Script *script, double origin, double period, int fn, int steps, int length);
+
+// Drop an event; nonzero if it was still scheduled
+int script_cancel(Script *script, int id);
+
+void script_free(Script *script);
+
+#endif // SCRIPT_H
@@ -0,0 +1,225 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include "stats.h"
+#include "audio.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+const int stats_bucket_pct[STATS_BUCKETS - 1] = {10, 25, 50, 75, 100, 150, 200};
+
+static atomic_ullong callbacks;
+static atomic_ullong underruns;
+static atomic_ullong dropped_frames;
+static atomic_ullong blocks;
+static atomic_ullong wakeups;
+static atomic_ullong render_hist[STATS_BUCKETS];
+static atomic_uint render_max_us;
+static atomic_ullong gc_us;
+static atomic_uint gc_max_us;
+static atomic_ullong jitter_sum_us;
+static atomic_ullong jitter_count;
+static atomic_uint jitter_max_us;
+static atomic_uint ring_min = UINT_MAX;
+
+static double last_stream_time;   // audio callback only
+static FILE *log_file;
+static double log_start;
+
+double stats_now(void) {
+#ifdef _WIN32
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static void store_max(atomic_uint *max, unsigned int v) {
+    unsigned int cur = atomic_load_explicit(max, memory_order_relaxed);
+    while (v > cur && !atomic_compare_exchange_weak(max, &cur, v)) {
+    }
+}
+
+static void store_min(atomic_uint *min, unsigned int v) {
+    unsigned int cur = atomic_load_explicit(min, memory_order_relaxed);
+    while (v < cur && !atomic_compare_exchange_weak(min, &cur, v)) {
+    }
+}
+
+static unsigned int to_us(double seconds) {
+    double us = seconds * 1e6;
+    return us >= (double)UINT_MAX ? UINT_MAX : (unsigned int)us;
+}
+
+void stats_callback(double stream_time, unsigned int frames, unsigned int fill,
+                    unsigned int got, int sample_rate) {
+    atomic_fetch_add_explicit(&callbacks, 1, memory_order_relaxed);
+    if (got < frames) {
+        atomic_fetch_add_explicit(&underruns, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&dropped_frames, frames - got, memory_order_relaxed);
+    }
+    store_min(&ring_min, fill);
+
+    // Jitter: how far the time between callbacks strays from the period
+    // (some host APIs report no stream time, leaving it at 0)
+    if (stream_time > 0.0 && last_stream_time > 0.0) {
+        double error = (stream_time - last_stream_time) - (double)frames / sample_rate;
+        unsigned int us = to_us(error < 0.0 ? -error : error);
+        atomic_fetch_add_explicit(&jitter_sum_us, us, memory_order_relaxed);
+        atomic_fetch_add_explicit(&jitter_count, 1, memory_order_relaxed);
+        store_max(&jitter_max_us, us);
+    }
+    last_stream_time = stream_time;
+}
+
+unsigned long long stats_underruns(void) {
+    return atomic_load_explicit(&underruns, memory_order_relaxed);
+}
+
+void stats_wakeup(void) {
+    atomic_fetch_add_explicit(&wakeups, 1, memory_order_relaxed);
+}
+
+void stats_block(double seconds, double deadline) {
+    int pct = (int)(seconds / deadline * 100.0);
+    int bucket = 0;
+    while (bucket < STATS_BUCKETS - 1 && pct >= stats_bucket_pct[bucket]) {
+        bucket++;
+    }
+    atomic_fetch_add_explicit(&render_hist[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&blocks, 1, memory_order_relaxed);
+    store_max(&render_max_us, to_us(seconds));
+}
+
+void stats_gc(double seconds) {
+    unsigned int us = to_us(seconds);
+    atomic_fetch_add_explicit(&gc_us, us, memory_order_relaxed);
+    store_max(&gc_max_us, us);
+}
+
+void stats_snapshot(StatsSnapshot *snap) {
+    memset(snap, 0, sizeof(*snap));
+    snap->callbacks = atomic_load(&callbacks);
+    snap->underruns = atomic_load(&underruns);
+    snap->dropped_frames = atomic_load(&dropped_frames);
+    snap->blocks = atomic_load(&blocks);
+    snap->wakeups = atomic_load(&wakeups);
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        snap->render_hist[i] = atomic_load(&render_hist[i]);
+    }
+    for (int i = 0; i < audio_state.track_count; i++) {
+        snap->late_blocks += atomic_load(&audio_state.tracks[i].underruns);
+    }
+    snap->render_max = atomic_load(&render_max_us) * 1e-6;
+    snap->gc_time = atomic_load(&gc_us) * 1e-6;
+    snap->gc_max = atomic_load(&gc_max_us) * 1e-6;
+    if (audio_state.sample_rate > 0) {
+        snap->deadline = (double)audio_state.buffer_size / audio_state.sample_rate;
+    }
+
+    unsigned long long count = atomic_load(&jitter_count);
+    if (count > 0) {
+        snap->jitter_mean = (double)atomic_load(&jitter_sum_us) / count * 1e-6;
+    }
+    snap->jitter_max = atomic_load(&jitter_max_us) * 1e-6;
+
+    if (audio_state.rb.data) {
+        snap->ring_fill = rb_count(&audio_state.rb);
+        snap->ring_size = audio_state.rb.size;
+        snap->latency = atomic_load(&audio_state.latency);
+    }
+    unsigned int min = atomic_load(&ring_min);
+    snap->ring_min = min == UINT_MAX ? snap->ring_fill : min;
+}
+
+int stats_open(const char *path) {
+    if (strcmp(path, "-") == 0) {
+        log_file = stderr;
+    } else {
+        log_file = fopen(path, "a");
+        if (!log_file) {
+            fprintf(stderr, "Error: Cannot open stats file %s\n", path);
+            return 1;
+        }
+    }
+    log_start = stats_now();
+    return 0;
+}
+
+// Write a string as a JSON string literal
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fputc('\\', f);
+        }
+        if ((unsigned char)*s >= 0x20) {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+void stats_log(void) {
+    if (!log_file) {
+        return;
+    }
+
+    StatsSnapshot snap;
+    stats_snapshot(&snap);
+    FILE *f = log_file;
+    fprintf(f, "{\"time\": %.3f, \"callbacks\": %llu, \"underruns\": %llu, \"dropped_frames\": %llu",
+            stats_now() - log_start, snap.callbacks, snap.underruns, snap.dropped_frames);
+    fprintf(f, ", \"ring_fill\": %u, \"ring_min\": %u, \"ring_size\": %u, \"latency_ms\": %.3f",
+            snap.ring_fill, snap.ring_min, snap.ring_size,
+            audio_state.sample_rate > 0 ? snap.latency * 1e3 / audio_state.sample_rate : 0.0);
+    fprintf(f, ", \"jitter_ms\": %.3f, \"jitter_max_ms\": %.3f, \"wakeups\": %llu",
+            snap.jitter_mean * 1e3, snap.jitter_max * 1e3, snap.wakeups);
+    fprintf(f, ", \"blocks\": %llu, \"late_blocks\": %llu, \"deadline_ms\": %.3f, \"render_max_ms\": %.3f",
+            snap.blocks, snap.late_blocks, snap.deadline * 1e3, snap.render_max * 1e3);
+    fprintf(f, ", \"gc_ms\": %.3f, \"gc_max_ms\": %.3f", snap.gc_time * 1e3, snap.gc_max * 1e3);
+    fprintf(f, ", \"render_hist\": {");
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        if (i < STATS_BUCKETS - 1) {
+            fprintf(f, "%s\"<%d%%\": %llu", i ? ", " : "", stats_bucket_pct[i], snap.render_hist[i]);
+        } else {
+            fprintf(f, ", \">=%d%%\": %llu", stats_bucket_pct[i - 1], snap.render_hist[i]);
+        }
+    }
+    fprintf(f, "}, \"tracks\": [");
+    for (int i = 0; i < audio_state.track_count; i++) {
+        Track *track = &audio_state.tracks[i];
+        fprintf(f, "%s{\"path\": ", i ? ", " : "");
+        json_string(f, track->path);
+        fprintf(f, ", \"late_blocks\": %u, \"lua_kb\": %u}",
+                atomic_load(&track->underruns), atomic_load(&track->lua_kb));
+    }
+    fprintf(f, "]}\n");
+    fflush(f);
+
+    // Start a new interval for the worst-case figures
+    atomic_store(&render_max_us, 0);
+    atomic_store(&gc_max_us, 0);
+    atomic_store(&jitter_max_us, 0);
+    atomic_store(&jitter_sum_us, 0);
+    atomic_store(&jitter_count, 0);
+    atomic_store(&ring_min, UINT_MAX);
+}
+
+void stats_close(void) {
+    if (log_file && log_file != stderr) {
+        fclose(log_file);
+    }
+    log_file = NULL;
+}
@@ -0,0 +1,64 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+// Real-time counters, updated with atomics from the audio callback and the
+// render threads, and read by chip.stats() and the periodic JSON log.
+// Nothing here takes a lock, so it is safe on the audio path.
+
+// Histogram of per-block render time, in percent of the block deadline.
+// Bucket i counts blocks under stats_bucket_pct[i]; the last one the rest.
+#define STATS_BUCKETS 8
+extern const int stats_bucket_pct[STATS_BUCKETS - 1];
+
+typedef struct StatsSnapshot {
+    unsigned long long callbacks;       // audio callbacks so far
+    unsigned long long underruns;       // callbacks padded with silence
+    unsigned long long dropped_frames;  // frames of silence padded
+    unsigned long long blocks;          // blocks rendered by all tracks
+    unsigned long long late_blocks;     // track blocks mixed as silence
+    unsigned long long wakeups;         // times the producer was woken
+    unsigned long long render_hist[STATS_BUCKETS];
+    double render_max;                  // slowest block, in seconds
+    double gc_time;                     // seconds spent in scheduled collection
+    double gc_max;                      // longest collection between two blocks
+    double deadline;                    // real time per block, in seconds
+    double jitter_mean;                 // callback period error, in seconds
+    double jitter_max;
+    unsigned int ring_fill;             // frames queued for the device
+    unsigned int ring_min;              // lowest fill seen by the callback
+    unsigned int ring_size;
+    unsigned int latency;               // frames the producer keeps queued
+} StatsSnapshot;
+
+// Monotonic clock in seconds
+double stats_now(void);
+
+// Audio callback: stream time of this callback, frames asked for, frames
+// queued before reading and frames actually read
+void stats_callback(double stream_time, unsigned int frames, unsigned int fill,
+                    unsigned int got, int sample_rate);
+
+// Device underruns so far
+unsigned long long stats_underruns(void);
+
+// Producer: woken up by the callback
+void stats_wakeup(void);
+
+// Render thread: one block took 'seconds' against a 'deadline'
+void stats_block(double seconds, double deadline);
+
+// Render thread: scheduled garbage collection after a block took 'seconds'
+void stats_gc(double seconds);
+
+// Current values. The interval figures (render_max, gc_max, jitter, ring_min)
+// cover the time since the last stats_log line.
+void stats_snapshot(StatsSnapshot *snap);
+
+// Write a JSON line of stats to path ("-" for stderr) on every stats_log
+int stats_open(const char *path);
+void stats_log(void);
+void stats_close(void);
+
+#endif // STATS_H
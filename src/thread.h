@@ -0,0 +1,156 @@
+#ifndef THREAD_H
+#define THREAD_H
+
+// Minimal thread, mutex, condition variable and semaphore wrappers over
+// Win32 and pthreads, for the helper threads that live outside audio.c.
+// Posting a semaphore never blocks or takes a lock (sem_post is even
+// async-signal-safe), so the audio callback and signal handlers may use it.
+
+#include <stdatomic.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <stdlib.h>
+#include <limits.h>
+
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE Cond;
+typedef HANDLE Semaphore;
+
+typedef struct ThreadStart {
+    void *(*fn)(void *);
+    void *arg;
+} ThreadStart;
+
+static DWORD WINAPI thread_trampoline(LPVOID param) {
+    ThreadStart start = *(ThreadStart *)param;
+    free(param);
+    start.fn(start.arg);
+    return 0;
+}
+
+static inline int thread_start(Thread *t, void *(*fn)(void *), void *arg) {
+    ThreadStart *start = (ThreadStart *)malloc(sizeof(ThreadStart));
+    if (!start) return 1;
+    start->fn = fn;
+    start->arg = arg;
+    *t = CreateThread(NULL, 0, thread_trampoline, start, 0, NULL);
+    if (*t == NULL) {
+        free(start);
+        return 1;
+    }
+    return 0;
+}
+
+static inline void thread_join(Thread t) {
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+
+static inline void mutex_init(Mutex *m) { InitializeCriticalSection(m); }
+static inline void mutex_destroy(Mutex *m) { DeleteCriticalSection(m); }
+static inline void mutex_lock(Mutex *m) { EnterCriticalSection(m); }
+static inline void mutex_unlock(Mutex *m) { LeaveCriticalSection(m); }
+
+static inline void cond_init(Cond *c) { InitializeConditionVariable(c); }
+static inline void cond_destroy(Cond *c) { (void)c; }
+static inline void cond_wait(Cond *c, Mutex *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static inline void cond_signal(Cond *c) { WakeConditionVariable(c); }
+static inline void cond_broadcast(Cond *c) { WakeAllConditionVariable(c); }
+
+static inline void thread_yield(void) { SwitchToThread(); }
+
+static inline int semaphore_init(Semaphore *s) {
+    *s = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    return *s == NULL;
+}
+static inline void semaphore_destroy(Semaphore *s) { CloseHandle(*s); }
+static inline void semaphore_post(Semaphore *s) { ReleaseSemaphore(*s, 1, NULL); }
+static inline void semaphore_wait(Semaphore *s) { WaitForSingleObject(*s, INFINITE); }
+// Returns 0 if posted, nonzero on timeout
+static inline int semaphore_timedwait(Semaphore *s, int ms) {
+    return WaitForSingleObject(*s, (DWORD)ms) != WAIT_OBJECT_0;
+}
+
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <time.h>
+
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t Cond;
+typedef sem_t Semaphore;
+
+static inline int thread_start(Thread *t, void *(*fn)(void *), void *arg) {
+    return pthread_create(t, NULL, fn, arg) != 0;
+}
+
+static inline void thread_join(Thread t) { pthread_join(t, NULL); }
+
+static inline void mutex_init(Mutex *m) { pthread_mutex_init(m, NULL); }
+static inline void mutex_destroy(Mutex *m) { pthread_mutex_destroy(m); }
+static inline void mutex_lock(Mutex *m) { pthread_mutex_lock(m); }
+static inline void mutex_unlock(Mutex *m) { pthread_mutex_unlock(m); }
+
+static inline void cond_init(Cond *c) { pthread_cond_init(c, NULL); }
+static inline void cond_destroy(Cond *c) { pthread_cond_destroy(c); }
+static inline void cond_wait(Cond *c, Mutex *m) { pthread_cond_wait(c, m); }
+static inline void cond_signal(Cond *c) { pthread_cond_signal(c); }
+static inline void cond_broadcast(Cond *c) { pthread_cond_broadcast(c); }
+
+static inline void thread_yield(void) { sched_yield(); }
+
+static inline int semaphore_init(Semaphore *s) { return sem_init(s, 0, 0) != 0; }
+static inline void semaphore_destroy(Semaphore *s) { sem_destroy(s); }
+static inline void semaphore_post(Semaphore *s) { sem_post(s); }
+static inline void semaphore_wait(Semaphore *s) {
+    while (sem_wait(s) != 0 && errno == EINTR) {
+    }
+}
+// Returns 0 if posted, nonzero on timeout
+static inline int semaphore_timedwait(Semaphore *s, int ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    int r;
+    while ((r = sem_timedwait(s, &ts)) != 0 && errno == EINTR) {
+    }
+    return r != 0;
+}
+#endif
+
+// A semaphore that is only posted while its waiter is armed, so a thread
+// signalled on every audio callback wakes once per wait instead of
+// piling up posts. The waiter arms, re-checks its condition, then waits.
+typedef struct Wakeup {
+    Semaphore sem;
+    atomic_int armed;
+} Wakeup;
+
+static inline int wakeup_init(Wakeup *w) {
+    atomic_init(&w->armed, 0);
+    return semaphore_init(&w->sem);
+}
+static inline void wakeup_destroy(Wakeup *w) { semaphore_destroy(&w->sem); }
+static inline void wakeup_arm(Wakeup *w) {
+    atomic_store(&w->armed, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+static inline void wakeup_wait(Wakeup *w) { semaphore_wait(&w->sem); }
+static inline void wakeup_signal(Wakeup *w) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_exchange(&w->armed, 0)) {
+        semaphore_post(&w->sem);
+    }
+}
+
+#endif // THREAD_H
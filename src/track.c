@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "track.h"
+#include "stats.h"
+#include "rt.h"
+
+// Blocks a track may render ahead of the mixer
+#define TRACK_BLOCKS 2
+// Share of the time left before a block is due that goes to collecting
+// the script's garbage
+#define TRACK_GC_SLACK 0.5
+// Default watchdog budget, in blocks: by then the track has long missed
+// its deadline
+#define TRACK_WATCHDOG_BLOCKS 4
+
+int track_open(Track *track, const char *path, int sample_rate, int render_rate,
+               int block_size, int channels, int crossfade) {
+    snprintf(track->path, sizeof(track->path), "%s", path);
+    track->sample_rate = sample_rate;
+    track->render_rate = render_rate;
+    track->block_size = block_size;
+    track->channels = channels;
+    track->crossfade = crossfade;
+    track->watchdog = TRACK_WATCHDOG_BLOCKS * (double)block_size / sample_rate;
+    track->priority = 0;
+    track->cpu = -1;
+    track->pure = 0;
+    track->workers = pure_default_workers();
+    track->version = 0;
+    track->pool = NULL;
+    track->pool_failed = 0;
+    atomic_store(&track->retired_pool, NULL);
+    track->old = NULL;
+    track->fade_pos = 0;
+    atomic_store(&track->late, 0);
+    atomic_store(&track->frame, 0);
+    atomic_store(&track->pending, NULL);
+    atomic_store(&track->retired, NULL);
+    atomic_store(&track->running, 0);
+    atomic_store(&track->underruns, 0);
+    atomic_store(&track->lua_kb, 0);
+
+    // The watchdog is installed by track_func, once main has set it
+    track->script = script_open(path, render_rate, block_size, channels, 0.0, 0);
+    if (!track->script) {
+        return 1;
+    }
+    int resampled = render_rate != sample_rate;
+    track->rb.data = NULL;
+    memset(&track->resampler, 0, sizeof(track->resampler));
+    memset(&track->old_resampler, 0, sizeof(track->old_resampler));
+    track->fade = (float *)malloc((size_t)block_size * channels * sizeof(float));
+    if (!track->fade ||
+        rb_init(&track->rb, (unsigned int)(block_size * TRACK_BLOCKS), (unsigned int)channels) != 0 ||
+        (resampled && (resampler_init(&track->resampler, render_rate, sample_rate, channels, block_size) != 0 ||
+                       resampler_init(&track->old_resampler, render_rate, sample_rate, channels, block_size) != 0))) {
+        fprintf(stderr, "Error: Failed to allocate buffers for %s\n", path);
+        free(track->fade);
+        rb_free(&track->rb);
+        resampler_free(&track->resampler);
+        resampler_free(&track->old_resampler);
+        script_free(track->script);
+        track->script = NULL;
+        return 1;
+    }
+    mutex_init(&track->lock);
+    cond_init(&track->cond);
+    return 0;
+}
+
+void track_close(Track *track) {
+    if (!track->script) {
+        return;
+    }
+    pure_stop(track->pool);
+    pure_stop(atomic_exchange(&track->retired_pool, NULL));
+    track->pool = NULL;
+    script_free(track->script);
+    script_free(track->old);
+    script_free(atomic_exchange(&track->pending, NULL));
+    script_free(atomic_exchange(&track->retired, NULL));
+    track->script = NULL;
+    track->old = NULL;
+    free(track->fade);
+    track->fade = NULL;
+    rb_free(&track->rb);
+    resampler_free(&track->resampler);
+    resampler_free(&track->old_resampler);
+    cond_destroy(&track->cond);
+    mutex_destroy(&track->lock);
+}
+
+// Swap in a reloaded script at the block boundary, once the previous
+// swap's script has been collected
+static void track_swap(Track *track) {
+    if (track->old || !atomic_load(&track->pending) || atomic_load(&track->retired)) {
+        return;
+    }
+    Script *next = atomic_exchange(&track->pending, NULL);
+    if (!next) {
+        return;
+    }
+    next->frame = track->script->frame;
+    script_gc_pause(next);
+    script_set_watchdog(next, track->watchdog);
+    track->old = track->script;
+    track->script = next;
+    track->version++;
+    track->pool_failed = 0;
+    // Joining the workers could take a while: the watcher stops them
+    if (track->pool && !track->pure && !next->pure && !atomic_load(&track->retired_pool)) {
+        atomic_store(&track->retired_pool, track->pool);
+        track->pool = NULL;
+    }
+    track->fade_pos = 0;
+    if (track->render_rate != track->sample_rate) {
+        // The old script keeps its resampler state through the fade
+        Resampler live = track->old_resampler;
+        track->old_resampler = track->resampler;
+        track->resampler = live;
+        resampler_reset(&track->resampler);
+    }
+    if (track->crossfade <= 0) {
+        atomic_store(&track->retired, track->old);
+        track->old = NULL;
+    }
+}
+
+// Render n frames of script at the render rate. The live script, when
+// pure, free of events and not fading in, is read from the pool; what the
+// pool can't provide (its workers are loading a reload, or handed a
+// block back) is rendered here.
+static void render_frames(Track *track, Script *script, float *out, int n) {
+    if (script == track->script && !track->old && (track->pure || script->pure) &&
+        script->sched.count == 0 && !track->pool_failed) {
+        if (!track->pool) {
+            track->pool = pure_start(track->path, track->render_rate, track->block_size,
+                                     track->channels, track->workers, track->watchdog,
+                                     track->priority);
+            track->pool_failed = track->pool == NULL;
+        }
+        if (track->pool) {
+            int got = pure_read(track->pool, out, script->frame, n, track->version,
+                                script->source);
+            script->frame += (unsigned long long)got;
+            script->time = (double)script->frame / script->sample_rate;
+            out += (size_t)got * track->channels;
+            n -= got;
+            if (n == 0) {
+                return;
+            }
+        }
+    }
+    script_render(script, out, n, script->gain);
+}
+
+// Render len frames of script at the output rate, going through its
+// resampler when the track runs at a lower render rate
+static void render_script(Track *track, Script *script, Resampler *rs, float *out, unsigned int len) {
+    if (track->render_rate == track->sample_rate) {
+        render_frames(track, script, out, (int)len);
+        return;
+    }
+    int want = resampler_want(rs, (int)len);
+    float *in = resampler_write_span(rs, want);
+    for (int done = 0; done < want; done += track->block_size) {
+        int n = want - done < track->block_size ? want - done : track->block_size;
+        render_frames(track, script, in + (size_t)done * track->channels, n);
+    }
+    resampler_read(rs, out, (int)len);
+}
+
+// Render one span of the live script into out. After a reload the
+// previous script keeps rendering into fade and is mixed out linearly.
+static void track_render(Track *track, float *out, unsigned int len) {
+    render_script(track, track->script, &track->resampler, out, len);
+    if (!track->old) {
+        return;
+    }
+
+    render_script(track, track->old, &track->old_resampler, track->fade, len);
+    const int ch = track->channels;
+    for (unsigned int i = 0; i < len; i++) {
+        float g = (float)(track->fade_pos + (int)i) / (float)track->crossfade;
+        if (g > 1.0f) g = 1.0f;
+        for (int c = 0; c < ch; c++) {
+            out[i * ch + c] = out[i * ch + c] * g + track->fade[i * ch + c] * (1.0f - g);
+        }
+    }
+    track->fade_pos += (int)len;
+    if (track->fade_pos >= track->crossfade) {
+        // Fade done: the watcher thread closes the old lua_State
+        atomic_store(&track->retired, track->old);
+        track->old = NULL;
+    }
+}
+
+// Jump over frames the mixer already played as silence, beyond those
+// still buffered (which the mixer drops itself). The mixer only ever
+// grows late - count, so reading count first never skips more than owed.
+static void track_catch_up(Track *track) {
+    unsigned int count = rb_count(&track->rb);
+    unsigned int late = atomic_load(&track->late);
+    if (late <= count) {
+        return;
+    }
+    unsigned int skip = late - count;
+    // Script frames run at the render rate
+    unsigned long long frames = skip;
+    if (track->render_rate != track->sample_rate) {
+        frames = (unsigned long long)((double)skip * track->render_rate / track->sample_rate + 0.5);
+    }
+    track->script->frame += frames;
+    if (track->old) {
+        track->old->frame += frames;
+    }
+    atomic_fetch_sub(&track->late, skip);
+}
+
+static void track_signal(Track *track) {
+    mutex_lock(&track->lock);
+    cond_broadcast(&track->cond);
+    mutex_unlock(&track->lock);
+}
+
+// Render thread: keeps the track's ring topped up, one block at a time
+static void *track_func(void *arg) {
+    Track *track = (Track *)arg;
+    const unsigned int block = (unsigned int)track->block_size;
+    const double deadline = (double)block / track->sample_rate;
+
+    if (track->priority > 0 || track->cpu >= 0) {
+        rt_thread(track->priority, track->cpu, track->path);
+    }
+    script_gc_pause(track->script);
+    script_set_watchdog(track->script, track->watchdog);
+    while (atomic_load(&track->running)) {
+        if (rb_space(&track->rb) < block) {
+            mutex_lock(&track->lock);
+            while (atomic_load(&track->running) && rb_space(&track->rb) < block) {
+                cond_wait(&track->cond, &track->lock);
+            }
+            mutex_unlock(&track->lock);
+            continue;
+        }
+
+        double start = stats_now();
+        track_swap(track);
+        track_catch_up(track);
+        unsigned int todo = block;
+        while (todo > 0) {
+            unsigned int len;
+            float *span = rb_write_span(&track->rb, &len);
+            if (len > todo) len = todo;
+            track_render(track, span, len);
+            rb_commit_write(&track->rb, len);
+            todo -= len;
+        }
+        atomic_store(&track->frame, track->script->frame);
+        double rendered = stats_now() - start;
+        stats_block(rendered, deadline);
+        track_signal(track);
+
+        // The collector is paused while rendering and catches up here
+        double gc = script_collect(track->script, (deadline - rendered) * TRACK_GC_SLACK);
+        if (gc > 0.0) {
+            stats_gc(gc);
+        }
+        atomic_store(&track->lua_kb, (unsigned int)lua_gc(track->script->L, LUA_GCCOUNT, 0));
+    }
+    return NULL;
+}
+
+int track_start(Track *track) {
+    if (atomic_load(&track->running)) {
+        return 0;
+    }
+    atomic_store(&track->running, 1);
+    if (thread_start(&track->thread, track_func, track) != 0) {
+        atomic_store(&track->running, 0);
+        return 1;
+    }
+    return 0;
+}
+
+void track_stop(Track *track) {
+    if (!atomic_load(&track->running)) {
+        return;
+    }
+    atomic_store(&track->running, 0);
+    track_signal(track);
+    thread_join(track->thread);
+}
+
+int track_ready(Track *tracks, int count, unsigned int n) {
+    for (int i = 0; i < count; i++) {
+        if (rb_count(&tracks[i].rb) < n + atomic_load(&tracks[i].late)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void track_mix(Track *tracks, int count, float *out, float *scratch,
+               unsigned int n, float volume, int wait) {
+    const unsigned int samples = n * (count > 0 ? tracks[0].rb.channels : 1);
+    memset(out, 0, samples * sizeof(float));
+
+    for (int t = 0; t < count; t++) {
+        Track *track = &tracks[t];
+        unsigned int got = 0;
+
+        // Drop what the track rendered for frames already mixed as silence.
+        // The debt is settled before the samples go, so the render thread
+        // never sees it as bigger than it is.
+        unsigned int late = atomic_load(&track->late);
+        if (late > 0) {
+            unsigned int drop = rb_count(&track->rb);
+            if (drop > late) drop = late;
+            late = atomic_fetch_sub(&track->late, drop) - drop;
+            rb_skip(&track->rb, drop);
+        }
+        if (late == 0) {
+            if (wait && rb_count(&track->rb) < n) {
+                mutex_lock(&track->lock);
+                while (atomic_load(&track->running) && rb_count(&track->rb) < n) {
+                    cond_wait(&track->cond, &track->lock);
+                }
+                mutex_unlock(&track->lock);
+            }
+            got = rb_read(&track->rb, scratch, n);
+        }
+        track_signal(track);
+
+        if (got < n) {
+            atomic_fetch_add(&track->late, n - got);
+            atomic_fetch_add(&track->underruns, 1);
+        }
+        for (unsigned int i = 0; i < got * track->rb.channels; i++) {
+            out[i] += scratch[i];
+        }
+    }
+
+    for (unsigned int i = 0; i < samples; i++) {
+        float v = out[i] * volume;
+        if (v > 1.0f) v = 1.0f;
+        if (v < -1.0f) v = -1.0f;
+        out[i] = v;
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <stdatomic.h>
+#include "ringbuf.h"
+#include "script.h"
+#include "thread.h"
+#include "resample.h"
+#include "pure.h"
+
+// Most scripts that can play at once
+#define TRACK_MAX 16
+
+// One script playing alongside the others. Each track renders on its own
+// thread into its own ring, a couple of blocks ahead of the mixer, so
+// tracks run on separate cores and a slow track only silences itself.
+typedef struct Track {
+    char path[256];
+    int sample_rate;
+    int render_rate;          // rate the scripts run at, resampled to sample_rate
+    int block_size;
+    int channels;             // interleaved channels per frame
+    int crossfade;            // samples to crossfade over on reload
+    double watchdog;          // seconds a block may take before it is aborted (0 = no limit)
+    int priority;             // SCHED_FIFO priority of the render thread (0 = normal)
+    int cpu;                  // CPU the render thread is pinned to (-1 = any)
+    Script *script;           // live script, owned by the render thread
+    // Pure scripts (--pure, or chip.pure()) are rendered ahead by a pool of
+    // workers, each with its own copy of the script
+    int pure;                 // treat every script as pure
+    int workers;              // threads in the pool
+    int version;              // live script's version, bumped on every swap
+    Pure *pool;               // started the first time the live script is pure
+    int pool_failed;
+    // Pool of a script reloaded as not pure, stopped by the watcher thread
+    _Atomic(Pure *) retired_pool;
+    RingBuffer rb;            // rendered frames, render thread -> mixer
+    atomic_ullong frame;      // script frames rendered so far, published after each block
+    // Live reload: the watcher compiles into 'pending', the render thread
+    // swaps it in at a block boundary and hands the old script back in 'retired'
+    _Atomic(Script *) pending;
+    _Atomic(Script *) retired;
+    // Render rate -> sample rate, for the live and the old script (unused
+    // when the rates are the same)
+    Resampler resampler;
+    Resampler old_resampler;
+    // Script being faded out after a reload (render thread only)
+    Script *old;
+    float *fade;
+    int fade_pos;
+    // Render thread; cond is signalled whenever samples are written or read
+    Thread thread;
+    Mutex lock;
+    Cond cond;
+    atomic_int running;
+    // Mixer side
+    atomic_uint late;         // frames mixed as silence and not yet skipped
+    atomic_uint underruns;    // blocks mixed as silence so far
+    atomic_uint lua_kb;       // memory used by the live lua_State, published per block
+} Track;
+
+// Load the script for a track, to run at render_rate (at most sample_rate)
+// and be resampled to sample_rate; 0 on success. The watchdog, priority,
+// CPU, pure and workers fields may be changed before track_start.
+int track_open(Track *track, const char *path, int sample_rate, int render_rate,
+               int block_size, int channels, int crossfade);
+
+// Free the track's scripts and buffers (after track_stop)
+void track_close(Track *track);
+
+// Start / stop the render thread
+int track_start(Track *track);
+void track_stop(Track *track);
+
+// Nonzero if every track has at least n frames ready
+int track_ready(Track *tracks, int count, unsigned int n);
+
+// Sum n interleaved frames of every track into out, scaled by volume and
+// clamped to [-1, 1]. With wait set, block until every track has rendered
+// them; otherwise a track that is behind is mixed as silence and counted
+// in its 'underruns'. The frames it renders late are dropped, or not
+// rendered at all, so it stays in time with the others. All tracks have
+// the same channel count; scratch holds at least n frames.
+void track_mix(Track *tracks, int count, float *out, float *scratch,
+               unsigned int n, float volume, int wait);
+
+#endif // TRACK_H
@@ -0,0 +1,344 @@
+#define _USE_MATH_DEFINES
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <sndfile.h>
+#include "wavetable.h"
+#include "thread.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Points per level, plus a copy of the first one so interpolation never wraps
+#define LEVEL_STRIDE (WAVETABLE_SIZE + 1)
+
+typedef struct WaveSlot {
+    char name[64];
+    _Atomic(float *) levels;   // WAVETABLE_LEVELS * LEVEL_STRIDE samples
+} WaveSlot;
+
+static WaveSlot slots[WAVETABLE_SLOTS];
+static atomic_int slot_count;
+// Levels replaced by a reload, freed at shutdown since readers may hold them
+static float **retired;
+static int retired_count;
+// Protects slot allocation and the retired list
+static Mutex wavetable_lock;
+static int wavetable_initialized;
+
+// In-place radix-2 FFT of n (a power of two) complex points; sign is -1
+// for the forward transform and +1 for the inverse (unscaled)
+static void fft(double *re, double *im, int n, int sign) {
+    for (int i = 1, j = 0; i < n; i++) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            double t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (int len = 2; len <= n; len <<= 1) {
+        double angle = sign * 2.0 * M_PI / len;
+        double wr = cos(angle), wi = sin(angle);
+        for (int i = 0; i < n; i += len) {
+            double cr = 1.0, ci = 0.0;
+            for (int k = 0; k < len / 2; k++) {
+                int a = i + k, b = i + k + len / 2;
+                double tr = re[b] * cr - im[b] * ci;
+                double ti = re[b] * ci + im[b] * cr;
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+                double next = cr * wr - ci * wi;
+                ci = cr * wi + ci * wr;
+                cr = next;
+            }
+        }
+    }
+}
+
+// Mip levels from the spectrum of one cycle, where bin k holds the
+// coefficient of exp(2 pi i k n / N)
+static float *build_levels(const double *spec_re, const double *spec_im) {
+    const int n = WAVETABLE_SIZE;
+    float *levels = (float *)malloc(sizeof(float) * WAVETABLE_LEVELS * LEVEL_STRIDE);
+    double *re = (double *)malloc(sizeof(double) * n);
+    double *im = (double *)malloc(sizeof(double) * n);
+    if (!levels || !re || !im) {
+        free(levels);
+        levels = NULL;
+        goto done;
+    }
+
+    for (int level = 0; level < WAVETABLE_LEVELS; level++) {
+        int harmonics = (n / 2) >> level;
+        if (harmonics > n / 2 - 1) harmonics = n / 2 - 1;
+        memset(re, 0, sizeof(double) * n);
+        memset(im, 0, sizeof(double) * n);
+        re[0] = spec_re[0];
+        for (int k = 1; k <= harmonics; k++) {
+            re[k] = spec_re[k];
+            im[k] = spec_im[k];
+            re[n - k] = spec_re[n - k];
+            im[n - k] = spec_im[n - k];
+        }
+        fft(re, im, n, 1);
+        float *table = levels + level * LEVEL_STRIDE;
+        for (int i = 0; i < n; i++) {
+            table[i] = (float)re[i];
+        }
+        table[n] = table[0];
+    }
+
+done:
+    free(re);
+    free(im);
+    return levels;
+}
+
+// Spectrum of sum(amp(k) * sin(2 pi k x)) over the harmonics below Nyquist
+static float *build_sines(double (*amp)(int k)) {
+    const int n = WAVETABLE_SIZE;
+    double *re = (double *)calloc(n, sizeof(double));
+    double *im = (double *)calloc(n, sizeof(double));
+    float *levels = NULL;
+    if (re && im) {
+        for (int k = 1; k < n / 2; k++) {
+            double a = amp(k);
+            im[k] = -0.5 * a;
+            im[n - k] = 0.5 * a;
+        }
+        levels = build_levels(re, im);
+    }
+    free(re);
+    free(im);
+    return levels;
+}
+
+static double sin_amp(int k) {
+    return k == 1 ? 1.0 : 0.0;
+}
+
+// Rising saw, 0 at phase 0
+static double saw_amp(int k) {
+    return (k % 2 ? 2.0 : -2.0) / (M_PI * k);
+}
+
+// +1 for the first half cycle
+static double sq_amp(int k) {
+    return k % 2 ? 4.0 / (M_PI * k) : 0.0;
+}
+
+// 0 at phase 0, peaking at a quarter cycle
+static double tri_amp(int k) {
+    if (k % 2 == 0) {
+        return 0.0;
+    }
+    double a = 8.0 / (M_PI * M_PI * k * k);
+    return (k / 2) % 2 ? -a : a;
+}
+
+// Publish levels under name, reusing the slot if the name exists.
+// Called with wavetable_lock held.
+static int publish(const char *name, float *levels) {
+    int count = atomic_load(&slot_count);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(slots[i].name, name) == 0) {
+            float **grown = (float **)realloc(retired, sizeof(float *) * (retired_count + 1));
+            if (!grown) {
+                return -1;
+            }
+            retired = grown;
+            retired[retired_count++] = atomic_exchange(&slots[i].levels, levels);
+            return i;
+        }
+    }
+    if (count == WAVETABLE_SLOTS) {
+        return -1;
+    }
+    snprintf(slots[count].name, sizeof(slots[count].name), "%s", name);
+    atomic_store(&slots[count].levels, levels);
+    atomic_store(&slot_count, count + 1);
+    return count;
+}
+
+int wavetable_init(void) {
+    static const struct {
+        const char *name;
+        double (*amp)(int k);
+    } builtins[] = {
+        {"sin", sin_amp},
+        {"saw", saw_amp},
+        {"sq", sq_amp},
+        {"tri", tri_amp},
+    };
+
+    if (wavetable_initialized) {
+        return 0;
+    }
+    mutex_init(&wavetable_lock);
+    wavetable_initialized = 1;
+    for (int i = 0; i < (int)(sizeof(builtins) / sizeof(builtins[0])); i++) {
+        float *levels = build_sines(builtins[i].amp);
+        if (!levels || publish(builtins[i].name, levels) < 0) {
+            fprintf(stderr, "Error: Failed to build the %s wavetable\n", builtins[i].name);
+            free(levels);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int wavetable_find(const char *name) {
+    int count = atomic_load(&slot_count);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(slots[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int wavetable_load(const char *name, const char *path) {
+    const int n = WAVETABLE_SIZE;
+    SF_INFO info = {0};
+    SNDFILE *file = sf_open(path, SFM_READ, &info);
+    if (!file) {
+        fprintf(stderr, "Error loading wavetable %s: %s\n", path, sf_strerror(NULL));
+        return -1;
+    }
+    if (info.frames < 2) {
+        fprintf(stderr, "Error loading wavetable %s: too short\n", path);
+        sf_close(file);
+        return -1;
+    }
+
+    float *frames = (float *)malloc((size_t)info.frames * info.channels * sizeof(float));
+    double *re = (double *)calloc(n, sizeof(double));
+    double *im = (double *)calloc(n, sizeof(double));
+    float *levels = NULL;
+    int handle = -1;
+    if (!frames || !re || !im) {
+        fprintf(stderr, "Error loading wavetable %s: out of memory\n", path);
+        goto done;
+    }
+    sf_count_t count = sf_readf_float(file, frames, info.frames);
+    if (count < 2) {
+        fprintf(stderr, "Error loading wavetable %s: %s\n", path, sf_strerror(file));
+        goto done;
+    }
+
+    // Resample the cycle to the table size, mixing down to mono
+    for (int i = 0; i < n; i++) {
+        double pos = (double)i * count / n;
+        sf_count_t a = (sf_count_t)pos;
+        sf_count_t b = (a + 1) % count;
+        double frac = pos - a;
+        double va = 0.0, vb = 0.0;
+        for (int c = 0; c < info.channels; c++) {
+            va += frames[a * info.channels + c];
+            vb += frames[b * info.channels + c];
+        }
+        re[i] = (va + (vb - va) * frac) / info.channels;
+    }
+    fft(re, im, n, -1);
+    for (int k = 0; k < n; k++) {
+        re[k] /= n;
+        im[k] /= n;
+    }
+
+    levels = build_levels(re, im);
+    if (!levels) {
+        fprintf(stderr, "Error loading wavetable %s: out of memory\n", path);
+        goto done;
+    }
+    mutex_lock(&wavetable_lock);
+    handle = publish(name, levels);
+    mutex_unlock(&wavetable_lock);
+    if (handle < 0) {
+        fprintf(stderr, "Error loading wavetable %s: too many wavetables\n", path);
+        free(levels);
+    }
+
+done:
+    sf_close(file);
+    free(frames);
+    free(re);
+    free(im);
+    return handle;
+}
+
+// Most detailed level whose harmonics stay below Nyquist at inc cycles per
+// sample: level k is safe once 2^k >= WAVETABLE_SIZE * inc
+static const float *level_for(int handle, double inc) {
+    if (handle < 0 || handle >= atomic_load(&slot_count)) {
+        return NULL;
+    }
+    const float *levels = atomic_load_explicit(&slots[handle].levels, memory_order_acquire);
+    int e;
+    double m = frexp(fabs(inc) * WAVETABLE_SIZE, &e);
+    int level = m == 0.5 ? e - 1 : e;
+    if (level < 0) level = 0;
+    if (level >= WAVETABLE_LEVELS) level = WAVETABLE_LEVELS - 1;
+    return levels + level * LEVEL_STRIDE;
+}
+
+// phase in [0, 1], where 1 can come out of phase - floor(phase) for a
+// tiny negative phase: it wraps to the first point
+static float lookup(const float *table, double phase) {
+    double x = phase * WAVETABLE_SIZE;
+    int whole = (int)x;
+    float frac = (float)(x - whole);
+    int i = whole & (WAVETABLE_SIZE - 1);
+    return table[i] + (table[i + 1] - table[i]) * frac;
+}
+
+float wavetable_value(int handle, double phase, double inc) {
+    const float *table = level_for(handle, inc);
+    if (!table) {
+        return 0.0f;
+    }
+    return lookup(table, phase - floor(phase));
+}
+
+void wavetable_fill(int handle, float *out, int n, double phase, double inc) {
+    const float *table = level_for(handle, inc);
+    if (!table) {
+        memset(out, 0, (size_t)(n > 0 ? n : 0) * sizeof(float));
+        return;
+    }
+    double p = phase - floor(phase);
+    for (int i = 0; i < n; i++) {
+        out[i] = lookup(table, p);
+        p += inc;
+        if (p >= 1.0 || p < 0.0) {
+            p -= floor(p);
+        }
+    }
+}
+
+void wavetable_shutdown(void) {
+    if (!wavetable_initialized) {
+        return;
+    }
+    int count = atomic_load(&slot_count);
+    for (int i = 0; i < count; i++) {
+        free(atomic_exchange(&slots[i].levels, NULL));
+    }
+    for (int i = 0; i < retired_count; i++) {
+        free(retired[i]);
+    }
+    free(retired);
+    retired = NULL;
+    retired_count = 0;
+    atomic_store(&slot_count, 0);
+    mutex_destroy(&wavetable_lock);
+    wavetable_initialized = 0;
+}
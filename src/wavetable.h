@@ -0,0 +1,40 @@
+#ifndef WAVETABLE_H
+#define WAVETABLE_H
+
+// Band-limited wavetables shared by every script, addressed by small
+// integer handles like the sample cache. A wavetable holds one cycle at
+// WAVETABLE_SIZE points in WAVETABLE_LEVELS mip levels: level k keeps the
+// first WAVETABLE_SIZE / 2 >> k harmonics. Reads pick the most detailed
+// level whose harmonics stay below Nyquist at the playback frequency and
+// interpolate linearly within it, so no pitch aliases.
+//
+// "sin", "saw", "sq" and "tri" are built in (same phase and level as the
+// chip.* functions); single-cycle waves are loaded with libsndfile. Tables
+// are immutable once published: loading a name again swaps in new levels
+// and keeps the old ones until shutdown, so readers never need a lock.
+
+#define WAVETABLE_SIZE 2048
+#define WAVETABLE_LEVELS 11
+#define WAVETABLE_SLOTS 64
+
+// Build the built-in tables; 0 on success
+int wavetable_init(void);
+
+// Handle of the table called name, or -1 if there is none
+int wavetable_find(const char *name);
+
+// Load the single-cycle wave in path (mixed down to mono, any length) as
+// name, replacing any table of that name. Returns its handle, or -1 with
+// the error printed.
+int wavetable_load(const char *name, const char *path);
+
+// Value at phase (in cycles) when advancing inc cycles per sample
+float wavetable_value(int handle, double phase, double inc);
+
+// Fill out[0..n) from phase, advancing inc cycles per sample
+void wavetable_fill(int handle, float *out, int n, double phase, double inc);
+
+// Free every table
+void wavetable_shutdown(void);
+
+#endif // WAVETABLE_H